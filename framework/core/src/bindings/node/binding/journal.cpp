@@ -48,15 +48,13 @@ Napi::Value Frame::Dest(const Napi::CallbackInfo &info) { return Napi::Number::N
 
 Napi::Value Frame::Data(const Napi::CallbackInfo &info) {
   auto result = Napi::Object::New(info.Env());
-  boost::hana::for_each(longfist::StateDataTypes, [&](auto it) {
-    using DataType = typename decltype(+boost::hana::second(it))::type;
-    if (frame_->msg_type() == DataType::tag) {
-      serialize::JsSet{}(frame_->data<DataType>(), result);
-      result.DefineProperties({
-          Napi::PropertyDescriptor::Value("tag", Napi::Number::New(result.Env(), DataType::tag)),
-          Napi::PropertyDescriptor::Value("type", Napi::String::New(result.Env(), DataType::type_name.c_str())) //
-      });
-    }
+  longfist::dispatch(longfist::StateDataTypes, frame_->msg_type(), [&](auto type) {
+    using DataType = typename decltype(type)::type;
+    serialize::JsSet{}(frame_->data<DataType>(), result);
+    result.DefineProperties({
+        Napi::PropertyDescriptor::Value("tag", Napi::Number::New(result.Env(), DataType::tag)),
+        Napi::PropertyDescriptor::Value("type", Napi::String::New(result.Env(), DataType::type_name.c_str())) //
+    });
   });
   return result;
 }
@@ -320,14 +320,13 @@ public:
           return;
         }
 
-        for (const auto &data : yijinjing::cache::time_spec<DataType>::get_all(storage, from, to)) {
+        yijinjing::cache::read_states<DataType>(location_, dest, storage, from, to, [&](const DataType &data) {
           try {
             set(data, state_, source, dest, now);
           } catch (const std::exception &e) {
             SPDLOG_ERROR("Unexpected exception by operator() set {}", e.what());
-            continue;
           }
-        }
+        });
       });
     }
   }
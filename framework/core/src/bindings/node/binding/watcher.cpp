@@ -575,22 +575,19 @@ void Watcher::SyncEventCache() {
 
 void Watcher::UpdateEventCache(const event_ptr &event) {
   const auto &request = event->data<CacheReset>();
-  boost::hana::for_each(StateDataTypes, [&](auto it) {
-    using DataType = typename decltype(+boost::hana::second(it))::type;
-    if (DataType::tag == request.msg_type) {
-      auto hana_type = boost::hana::type_c<DataType>;
-      using DelMap = std::unordered_map<uint64_t, state<DataType>>;
-      auto &del_map = const_cast<DelMap &>(data_bank_[hana_type]);
-      auto iter = del_map.begin();
-      while (iter != del_map.end()) {
-        auto s = iter->second;
-        auto source_id = s.source;
-        auto dest_id = s.dest;
-        if ((source_id == event->source() and dest_id == event->dest()) || source_id == event->dest()) {
-          iter = del_map.erase(iter);
-        } else {
-          iter++;
-        }
+  dispatch(StateDataTypes, request.msg_type, [&](auto hana_type) {
+    using DataType = typename decltype(hana_type)::type;
+    using DelMap = std::unordered_map<uint64_t, state<DataType>>;
+    auto &del_map = const_cast<DelMap &>(data_bank_[hana_type]);
+    auto iter = del_map.begin();
+    while (iter != del_map.end()) {
+      auto s = iter->second;
+      auto source_id = s.source;
+      auto dest_id = s.dest;
+      if ((source_id == event->source() and dest_id == event->dest()) || source_id == event->dest()) {
+        iter = del_map.erase(iter);
+      } else {
+        iter++;
       }
     }
   });
@@ -144,12 +144,15 @@ void bind(pybind11::module &&m) {
 
   // nanosecond-time related
   m.def("now_in_nano", &time::now_in_nano);
-  m.def("strftime", &time::strftime, py::arg("nanotime"), py::arg("format") = KUNGFU_TIMESTAMP_FORMAT);
+  m.def("strftime", py::overload_cast<int64_t, const std::string &>(&time::strftime), py::arg("nanotime"),
+        py::arg("format") = KUNGFU_TIMESTAMP_FORMAT);
   m.def("strptime", py::overload_cast<const std::string &, const std::string &>(&time::strptime), py::arg("timestr"),
         py::arg("format") = KUNGFU_TIMESTAMP_FORMAT);
   m.def("strfnow", &time::strfnow, py::arg("format") = KUNGFU_TIMESTAMP_FORMAT);
 
   m.def("get_page_path", &page::get_page_path);
+  m.def("compress_page", &page::compress);
+  m.def("verify_page", &page::verify);
 
   m.def("thread_id", &util::get_thread_id);
   m.def("in_color_terminal", &util::in_color_terminal);
@@ -185,6 +188,12 @@ void bind(pybind11::module &&m) {
     event_class.def(boost::hana::first(pair).c_str(), &event_to_data<DataType>);
   });
 
+  py::class_<page_verify_result>(m, "page_verify_result")
+      .def_readonly("frame_count", &page_verify_result::frame_count)
+      .def_readonly("end_position", &page_verify_result::end_position)
+      .def_readonly("torn", &page_verify_result::torn)
+      .def_readonly("closed", &page_verify_result::closed);
+
   py::class_<frame, event, frame_ptr>(m, "frame")
       .def_property_readonly("frame_length", &frame::frame_length)
       .def("has_data", &frame::has_data);
@@ -330,7 +339,8 @@ void bind(pybind11::module &&m) {
   py::class_<io_device_console, io_device, io_device_console_ptr>(m, "io_device_console")
       .def(py::init<location_ptr, uint32_t, uint32_t>(), py::arg("home"), py::arg("width"), py::arg("height"))
       .def("trace", &io_device_console::trace)
-      .def("show", &io_device_console::show);
+      .def("show", &io_device_console::show)
+      .def("export_columns", &io_device_console::export_columns);
 
   py::class_<session_finder, std::shared_ptr<session_finder>>(m, "session_finder")
       .def(py::init<io_device_ptr>())
@@ -340,7 +350,7 @@ void bind(pybind11::module &&m) {
 
   py::class_<session_builder, session_finder, std::shared_ptr<session_builder>>(m, "session_builder")
       .def(py::init<io_device_ptr>())
-      .def("rebuild_index_db", &session_builder::rebuild_index_db);
+      .def("rebuild_index_db", &session_builder::rebuild_index_db, py::arg("full") = false);
 
   auto profile_class = py::class_<profile, std::shared_ptr<profile>>(m, "profile");
   profile_class.def(py::init<const locator_ptr &>());
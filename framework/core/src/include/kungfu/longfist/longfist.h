@@ -9,6 +9,7 @@
 
 #include "kungfu/yijinjing/cache/ringqueue.h"
 #include <kungfu/longfist/types.h>
+#include <array>
 #include <unordered_set>
 
 #define TYPE_PAIR(DataType) boost::hana::make_pair(HANA_STR(#DataType), boost::hana::type_c<types::DataType>)
@@ -52,6 +53,7 @@ constexpr auto AllTypes = boost::hana::make_map( //
     TYPE_PAIR(StrategyStateUpdate),              //
     TYPE_PAIR(Commission),                       //
     TYPE_PAIR(Session),                          //
+    TYPE_PAIR(SessionCheckpoint),                //
     TYPE_PAIR(Location),                         //
     TYPE_PAIR(Register),                         //
     TYPE_PAIR(Deregister),                       //
@@ -107,6 +109,7 @@ constexpr auto AllTypes = boost::hana::make_map( //
     TYPE_PAIR(StrategyStateUpdate),                                   //
     TYPE_PAIR(Commission),                                            //
     TYPE_PAIR(Session),                                               //
+    TYPE_PAIR(SessionCheckpoint),                                     //
     TYPE_PAIR(Location),                                              //
     TYPE_PAIR(Register),                                              //
     TYPE_PAIR(Deregister),                                            //
@@ -159,7 +162,8 @@ constexpr auto ProfileDataTypes = boost::hana::make_map( //
 );
 
 constexpr auto SessionDataTypes = boost::hana::make_map( //
-    TYPE_PAIR(Session)                                   //
+    TYPE_PAIR(Session),                                  //
+    TYPE_PAIR(SessionCheckpoint)                         //
 );
 
 constexpr auto StateDataTypes = boost::hana::make_map( //
@@ -206,6 +210,78 @@ const auto build_data_set = [](auto types) {
 
 const std::unordered_set<int32_t> AllTypesTags = build_data_set(AllTypes);
 
+/**
+ * dense ordinal of msg types in AllTypes, looked up through an open addressing hash table built at compile time
+ */
+namespace msg_type_ordinal {
+constexpr size_t COUNT = decltype(boost::hana::length(AllTypes))::value;
+
+/** ordinal of msg types not in AllTypes */
+constexpr size_t NONE = COUNT;
+
+constexpr size_t SLOTS = 256;
+static_assert(SLOTS >= COUNT * 2, "too many types for msg type ordinal table");
+
+struct slot_entry {
+  int32_t msg_type;
+  size_t ordinal;
+};
+
+constexpr size_t hash(int32_t msg_type) { return (static_cast<uint32_t>(msg_type) * 2654435761u) >> 24u; }
+
+constexpr std::array<slot_entry, SLOTS> build_table() {
+  constexpr auto tags = boost::hana::unpack(boost::hana::values(AllTypes), [](auto... types) {
+    return std::array<int32_t, COUNT>{decltype(+types)::type::tag...};
+  });
+  std::array<slot_entry, SLOTS> table = {};
+  for (auto &slot : table) {
+    slot = {0, NONE};
+  }
+  for (size_t ordinal = 0; ordinal < COUNT; ordinal++) {
+    auto slot = hash(tags[ordinal]);
+    while (table[slot].ordinal != NONE and table[slot].msg_type != tags[ordinal]) {
+      slot = (slot + 1) % SLOTS;
+    }
+    if (table[slot].ordinal == NONE) {
+      table[slot] = {tags[ordinal], ordinal};
+    }
+  }
+  return table;
+}
+
+constexpr std::array<slot_entry, SLOTS> TABLE = build_table();
+
+constexpr size_t of(int32_t msg_type) {
+  for (auto slot = hash(msg_type);; slot = (slot + 1) % SLOTS) {
+    if (TABLE[slot].ordinal == NONE or TABLE[slot].msg_type == msg_type) {
+      return TABLE[slot].ordinal;
+    }
+  }
+}
+} // namespace msg_type_ordinal
+
+/**
+ * call handler with boost::hana::type_c<DataType> for the type in given map whose tag is msg_type, through a table of
+ * one function pointer per msg type ordinal, instead of comparing msg_type against every type in the map
+ * @return false if no type in map has the tag
+ */
+template <typename Types, typename Handler> bool dispatch(const Types &, int32_t msg_type, Handler &&handler) {
+  using HandlerType = std::remove_reference_t<Handler>;
+  using Invoker = void (*)(HandlerType &);
+  static constexpr auto table = boost::hana::unpack(boost::hana::values(Types{}), [](auto... types) {
+    std::array<Invoker, msg_type_ordinal::COUNT + 1> invokers = {};
+    ((invokers[msg_type_ordinal::of(decltype(+types)::type::tag)] =
+          [](HandlerType &h) { h(boost::hana::type_c<typename decltype(+types)::type>); }),
+     ...);
+    return invokers;
+  });
+  auto invoker = table[msg_type_ordinal::of(msg_type)];
+  if (invoker != nullptr) {
+    invoker(handler);
+  }
+  return invoker != nullptr;
+}
+
 constexpr auto build_data_map = [](auto types) {
   auto maps = boost::hana::transform(boost::hana::values(types), [](auto value) {
     using DataType = typename decltype(+value)::type;
@@ -237,7 +313,7 @@ DECLARE_PTR(ProfileMapType)
 using StateMapType = decltype(build_state_map(longfist::StateDataTypes));
 DECLARE_PTR(StateMapType)
 
-static size_t TRADING_MAP_RING_SIZE = 1024;
+constexpr size_t TRADING_MAP_RING_SIZE = 1024;
 using TradingMapType = decltype(build_ring_state_map(longfist::TradingDataTypes, TRADING_MAP_RING_SIZE));
 DECLARE_PTR(TradingMapType)
 
@@ -140,6 +140,14 @@ KF_DEFINE_DATA_TYPE(                                                     //
     (uint64_t, data_size)                                                //
 );
 
+KF_DEFINE_DATA_TYPE(                                                  //
+    SessionCheckpoint, 10015, PK(location_uid, dest_id), PERPETUAL(), //
+    (uint32_t, location_uid),                                         //
+    (uint32_t, dest_id),                                              //
+    (int64_t, read_time),                                             //
+    (uint32_t, read_count)                                            //
+);
+
 KF_DEFINE_DATA_TYPE(                                //
     Register, 10011, PK(location_uid), PERPETUAL(), //
     (uint32_t, location_uid),                       //
@@ -9,6 +9,7 @@
 
 #include <kungfu/longfist/longfist.h>
 #include <kungfu/yijinjing/cache/runtime.h>
+#include <kungfu/yijinjing/cache/snapshot.h>
 #include <kungfu/yijinjing/cache/sqlite_orm_ext.h>
 #include <kungfu/yijinjing/journal/journal.h>
 #include <kungfu/yijinjing/time.h>
@@ -75,19 +76,38 @@ template <typename DataType> struct time_spec<DataType, std::enable_if_t<not Dat
   static std::vector<DataType> get_all(StateStoragePtr &storage, int64_t, int64_t) {
     return storage->get_all<DataType>();
   };
+
+  static bool contains(const DataType &, int64_t, int64_t) { return true; }
 };
 
 template <typename DataType> struct time_spec<DataType, std::enable_if_t<DataType::has_timestamp>> {
-  static std::vector<DataType> get_all(StateStoragePtr &storage, int64_t from, int64_t to) {
+  static auto timestamp_member() {
     auto comparator = [](auto it) { return DataType::timestamp_key.value() == boost::hana::first(it); };
     auto just = boost::hana::find_if(boost::hana::accessors<DataType>(), comparator);
     [[maybe_unused]] auto accessor = boost::hana::second(*just);
-    auto ts = member_pointer_trait<decltype(accessor)>().pointer();
+    return member_pointer_trait<decltype(accessor)>().pointer();
+  }
+
+  static std::vector<DataType> get_all(StateStoragePtr &storage, int64_t from, int64_t to) {
+    auto ts = timestamp_member();
     return storage->get_all<DataType>(sqlite_orm::where(
         sqlite_orm::and_(sqlite_orm::greater_or_equal(ts, from), sqlite_orm::lesser_or_equal(ts, to))));
   };
+
+  static bool contains(const DataType &data, int64_t from, int64_t to) {
+    auto timestamp = data.*timestamp_member();
+    return timestamp >= from and timestamp <= to;
+  }
 };
 
+/**
+ * call handler for each state of given location and dest stored within [from, to), from snapshot file if the type is
+ * kept in snapshots, from sqlite storage otherwise. All readers of cached states should go through here.
+ */
+template <typename DataType, typename Handler>
+void read_states(const yijinjing::data::location_ptr &location, uint32_t dest, StateStoragePtr &storage, int64_t from,
+                 int64_t to, Handler &&handler);
+
 class shift {
 public:
   shift() = default;
@@ -98,6 +118,15 @@ public:
 
   void ensure_storage(uint32_t dest);
 
+  /**
+   * keep states of given types in mmap snapshot files instead of sqlite, types are named as in StateDataTypes, or
+   * "all" for every type. Types not of fixed size always stay in sqlite. Initial value is taken from env
+   * KF_CACHE_SNAPSHOT_TYPES, a comma separated list of type names, e.g. "Order,Trade"
+   */
+  static void set_snapshot_types(const std::vector<std::string> &type_names);
+
+  [[nodiscard]] static bool is_snapshot_type(int32_t msg_type);
+
   template <typename TargetType> void operator>>(TargetType &target) {
     for (auto dest : location_->locator->list_location_dest_by_db(location_)) {
       ensure_storage(dest);
@@ -110,46 +139,126 @@ public:
     });
   }
 
+  /**
+   * states stored from now on until commit_batch go to sqlite in one transaction per dest storage
+   */
+  void begin_batch();
+
+  /**
+   * commit transactions opened since begin_batch, those not committed yet are rolled back if one fails
+   */
+  void commit_batch();
+
   template <typename DataType> void operator<<(const typed_event_ptr<DataType> &event) {
-    ensure_storage(event->dest());
-    storage_map_.at(event->dest())->replace(event->template data<DataType>());
+    store(event->dest(), event->template data<DataType>());
   }
 
-  template <typename DataType> void operator<<(const state<DataType> &s) {
-    ensure_storage(s.dest);
-    storage_map_.at(s.dest)->replace(s.data);
-  }
+  template <typename DataType> void operator<<(const state<DataType> &s) { store(s.dest, s.data); }
 
   template <typename DataType> void operator-=(const typed_event_ptr<DataType> &event) {
     ensure_storage(event->dest());
     storage_map_.at(event->dest())->template remove_all<DataType>();
+    clear_snapshot<DataType>(event->dest());
   }
 
   template <typename DataType> void operator/=(const typed_event_ptr<DataType> &) {
     for (auto &pair : storage_map_) {
       pair.second->template remove_all<DataType>();
+      clear_snapshot<DataType>(pair.first);
     }
   }
 
 private:
   yijinjing::data::location_ptr location_;
   std::unordered_map<uint32_t, StateStoragePtr> storage_map_;
+  /** prepared replace statements keyed by dest in high 32 bits and msg type in low 32 bits */
+  std::unordered_map<uint64_t, std::shared_ptr<void>> statements_ = {};
+  bool batching_ = false;
+  std::vector<uint32_t> transactions_ = {};
+  /** snapshots keyed by dest in high 32 bits and msg type in low 32 bits */
+  std::unordered_map<uint64_t, snapshot_ptr> snapshots_ = {};
+
+  template <typename DataType> snapshot &get_snapshot(uint32_t dest) {
+    auto key = uint64_t(dest) << 32u | uint32_t(DataType::tag);
+    auto it = snapshots_.find(key);
+    if (it == snapshots_.end()) {
+      auto path = snapshot::get_path(location_, dest, DataType::type_name.c_str());
+      it = snapshots_.emplace(key, std::make_shared<snapshot>(path, DataType::tag, sizeof(DataType))).first;
+    }
+    return *it->second;
+  }
+
+  template <typename DataType> void clear_snapshot(uint32_t dest) {
+    if constexpr (size_fixed_v<DataType>) {
+      if (is_snapshot_type(DataType::tag)) {
+        get_snapshot<DataType>(dest).clear();
+      }
+    }
+  }
+
+  template <typename DataType> void store(uint32_t dest, const DataType &data) {
+    ensure_storage(dest);
+    if constexpr (size_fixed_v<DataType>) {
+      if (is_snapshot_type(DataType::tag)) {
+        get_snapshot<DataType>(dest).put(data.uid(), &data);
+        return;
+      }
+    }
+    auto &storage = storage_map_.at(dest);
+    if (batching_ and std::find(transactions_.begin(), transactions_.end(), dest) == transactions_.end()) {
+      storage->begin_transaction();
+      transactions_.push_back(dest);
+    }
+    auto &statement = replace_statement<DataType>(dest);
+    sqlite_orm::get<0>(statement) = data;
+    storage->execute(statement);
+  }
+
+  template <typename DataType> auto &replace_statement(uint32_t dest) {
+    using Statement = sqlite_orm::internal::prepared_statement_t<sqlite_orm::internal::replace_t<DataType>>;
+    auto key = uint64_t(dest) << 32u | uint32_t(DataType::tag);
+    auto it = statements_.find(key);
+    if (it == statements_.end()) {
+      // prepared statements finalize on destruction, construct in place to avoid copies
+      auto statement = new Statement(storage_map_.at(dest)->prepare(sqlite_orm::replace(DataType{})));
+      it = statements_.emplace(key, std::shared_ptr<Statement>(statement)).first;
+    }
+    return *std::static_pointer_cast<Statement>(it->second);
+  }
 
   template <typename DataType>
   void restore(yijinjing::journal::writer_ptr &writer, uint32_t dest, StateStoragePtr &storage) {
-    for (auto &data : time_spec<DataType>::get_all(storage, yijinjing::time::today_start(), INT64_MAX)) {
-      writer->write(0, data);
-    }
+    read_states<DataType>(location_, dest, storage, yijinjing::time::today_start(), INT64_MAX,
+                          [&](const DataType &data) { writer->write(0, data); });
   }
 
   template <typename DataType> void restore(yijinjing::cache::bank &bank, uint32_t dest, StateStoragePtr &storage) {
     auto from = yijinjing::time::today_start();
-    for (auto &data : time_spec<DataType>::get_all(storage, from, INT64_MAX)) {
-      bank << state(location_->uid, dest, from, data);
-    }
+    read_states<DataType>(location_, dest, storage, from, INT64_MAX,
+                          [&](const DataType &data) { bank << state(location_->uid, dest, from, data); });
   }
 };
 DECLARE_PTR(shift)
+
+template <typename DataType, typename Handler>
+void read_states(const yijinjing::data::location_ptr &location, uint32_t dest, StateStoragePtr &storage, int64_t from,
+                 int64_t to, Handler &&handler) {
+  if constexpr (size_fixed_v<DataType>) {
+    if (shift::is_snapshot_type(DataType::tag)) {
+      auto path = snapshot::get_path(location, dest, DataType::type_name.c_str());
+      snapshot(path, DataType::tag, sizeof(DataType), false).for_each([&](const void *address) {
+        const DataType &data = *reinterpret_cast<const DataType *>(address);
+        if (time_spec<DataType>::contains(data, from, to)) {
+          handler(data);
+        }
+      });
+      return;
+    }
+  }
+  for (auto &data : time_spec<DataType>::get_all(storage, from, to)) {
+    handler(data);
+  }
+}
 } // namespace kungfu::yijinjing::cache
 
 #endif // KUNGFU_CACHE_BACKEND_H
@@ -52,13 +52,41 @@ protected:
 private:
   std::unordered_map<uint32_t, yijinjing::cache::shift> app_cache_shift_ = {};
   yijinjing::cache::bank feed_bank_;
+  /** trading states in the order they come, feed bank keeps those left over by failed commits or missing shifts */
+  yijinjing::cache::trading_bank trading_bank_;
   yijinjing::practice::profile profile_;
   ProfileStateBank profile_bank_ = ProfileStateBank(longfist::ProfileDataTypes);
   const int store_volume_every_loop_;
+  const size_t max_store_volume_every_loop_;
+
+  struct stored_feed {
+    int32_t msg_type;
+    uint32_t source;
+    uint64_t uid;
+  };
+
+  /** states stored by current batch, to be dropped from feed bank once committed */
+  std::vector<stored_feed> stored_feeds_ = {};
 
   void on_location(const event_ptr &event);
 
-  void handle_cached_feeds(int store_volume_every_loop);
+  /**
+   * store a fraction of pending states that adapts to the backlog, within given bounds, in one transaction per storage
+   */
+  void handle_cached_feeds(size_t min_store_volume, size_t max_store_volume);
+
+  /**
+   * store states in trading bank rings, up to given volume
+   * @return number of states taken from each ring, in the order of TradingDataTypes
+   */
+  std::vector<size_t> store_trading_feeds(size_t store_volume);
+
+  /**
+   * pop stored states from rings, move those of sources failed to commit back to feed bank, so that they are retried
+   */
+  void settle_trading_feeds(const std::vector<size_t> &stored_volumes, const std::unordered_set<uint32_t> &failed);
+
+  void feed_trading(const event_ptr &event);
 
   void handle_profile_feeds(int store_volume_every_loop);
 
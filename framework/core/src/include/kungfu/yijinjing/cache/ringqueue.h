@@ -1,188 +1,132 @@
-
 // SPDX-License-Identifier: Apache-2.0
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
-#include <kungfu/common.h>
-#include <mutex>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
-#if 0
 namespace kungfu::yijinjing::cache {
+/**
+ * Bounded lock-free queue for one producer thread and one consumer thread, capacity is rounded up to a power of two
+ * and all memory is allocated at construction.
+ * Push fails when the queue is full, elements not popped yet are never overwritten, it is up to the producer to wait,
+ * drain or divert. Consumer can look at pending elements in place with at() and pop them once done.
+ */
 template <typename T> class ringqueue {
 public:
-  explicit ringqueue(size_t capacity) : capacityMask_(capacity - 1), tail_(0), head_(0) {
-    for (size_t i = 1; i <= sizeof(void *) * 4; i <<= 1) {
-      capacityMask_ |= capacityMask_ >> i;
-    }
-    capacity_ = capacityMask_ + 1;
-    queue_ = (T *)new char[sizeof(T) * capacity_];
-    pop_value_ = (T *)new char[sizeof(T)];
-  }
+  explicit ringqueue(size_t capacity)
+      : capacity_(round_up(capacity)), mask_(capacity_ - 1), slots_(std::make_unique<slot[]>(capacity_)) {}
 
-  ringqueue(ringqueue &&that)
-      : capacity_(that.capacity_), capacityMask_(that.capacityMask_), head_(that.head_), tail_(that.tail_),
-        queue_(that.queue_), pop_value_(that.pop_value_) {
-    that.queue_ = nullptr;
-    that.pop_value_ = nullptr;
-  }
+  ringqueue(const ringqueue &) = delete;
 
-  ringqueue(const ringqueue &that)
-      : capacity_(that.capacity_), capacityMask_(that.capacityMask_), head_(that.head_), tail_(that.tail_),
-        queue_((T *)new char[sizeof(T) * that.capacity_]) {
-    for (int i = 0; i < that.size(); i++) {
-      T *node = queue_ + i;
-      new (node) T(*(that.queue_ + i));
-    }
-    new (pop_value_) T(*(that.pop_value_));
-  }
+  ringqueue &operator=(const ringqueue &) = delete;
+
+  ~ringqueue() { pop(size()); }
 
-  ~ringqueue() {
-    for (size_t i = head_; i != tail_; ++i)
-      (&queue_[i & capacityMask_])->~T();
-    (pop_value_)->~T();
-    delete[](char *) queue_;
-    delete[](char *) pop_value_;
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+
+  /** exact when called from producer or consumer thread while the other side is idle, a snapshot otherwise */
+  [[nodiscard]] size_t size() const {
+    auto head = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - head;
   }
 
-  size_t capacity() const { return capacity_; }
+  [[nodiscard]] bool empty() const { return size() == 0; }
 
-  size_t size() const { return tail_ - head_; }
+  /**
+   * called by producer
+   * @return false if the queue is full, value is not taken then
+   */
+  bool push(const T &value) { return emplace(value); }
 
-  bool push(const T &p_data) {
-    T *node;
-    if (mtx_.try_lock()) {
-      node = &queue_[tail_ & capacityMask_];
-      if (tail_ - head_ >= capacity_) {
-        head_ = tail_ + 1;
-      }
-      new (node) T(p_data);
-      tail_ = tail_ + 1;
-      mtx_.unlock();
-      return true;
-    } else {
-      return false;
-    }
-  }
+  bool push(T &&value) { return emplace(std::move(value)); }
 
-  bool pop(T *&result) {
-    if (head_ >= tail_) {
-      return false;
-    }
-    T *node;
-    result = nullptr;
-    if (mtx_.try_lock()) {
-      if (head_ >= tail_) {
-        mtx_.unlock();
+  template <typename... Args> bool emplace(Args &&...args) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ >= capacity_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ >= capacity_) {
         return false;
       }
-      node = &queue_[head_ & capacityMask_];
-      head_ = head_ + 1;
-      *pop_value_ = *node;
-      result = pop_value_;
-      node->~T();
-      mtx_.unlock();
-      return true;
-    } else {
-      return false;
     }
+    new (slot_address(tail)) T(std::forward<Args>(args)...);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
   }
 
-private:
-  size_t capacityMask_;
-  T *queue_;
-  T *pop_value_;
-  size_t capacity_;
-  volatile size_t tail_;
-  volatile size_t head_;
-  std::mutex mtx_;
-};
-} // namespace kungfu::yijinjing::cache
-#endif
-namespace kungfu::yijinjing::cache {
-template <typename T> class ringqueue {
-public:
-  explicit ringqueue(size_t capacity) {
-    capacityMask_ = capacity - 1;
-    for (size_t i = 1; i <= sizeof(void *) * 4; i <<= 1) {
-      capacityMask_ |= capacityMask_ >> i;
+  /**
+   * called by consumer, number of elements available to at() and pop()
+   */
+  size_t available() {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (tail_cache_ - head == 0) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
     }
-    capacity_ = capacityMask_ + 1;
-    queue_ = (T *)new char[sizeof(T) * capacity_];
-    pop_value_ = (T *)new char[sizeof(T)];
-    tail_.store(0, std::memory_order_relaxed);
-    head_.store(0, std::memory_order_relaxed);
+    return tail_cache_ - head;
   }
 
-  ringqueue(ringqueue &&that)
-      : capacity_(that.capacity_), capacityMask_(that.capacityMask_), head_(that.head_.load(std::memory_order_relaxed)),
-        tail_(that.tail_.load(std::memory_order_relaxed)), queue_(that.queue_), pop_value_(that.pop_value_) {
-    that.queue_ = nullptr;
-    that.pop_value_ = nullptr;
-  }
-
-  ringqueue(const ringqueue &that)
-      : capacity_(that.capacity_), capacityMask_(that.capacityMask_), head_(that.head_.load(std::memory_order_relaxed)),
-        tail_(that.tail_.load(std::memory_order_relaxed)), queue_((T *)new char[sizeof(T) * that.capacity_]) {
-    for (int i = 0; i < that.size(); i++) {
-      T *node = queue_ + i;
-      new (node) T(*(that.queue_ + i));
+  /**
+   * called by consumer, n-th element from the front, n must be less than available()
+   */
+  T &at(size_t n) { return *std::launder(slot_address(head_.load(std::memory_order_relaxed) + n)); }
+
+  /**
+   * called by consumer, destroy up to n elements from the front
+   * @return number of elements popped
+   */
+  size_t pop(size_t n = 1) {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto count = std::min(n, tail_.load(std::memory_order_acquire) - head);
+    if constexpr (not std::is_trivially_destructible_v<T>) {
+      for (size_t i = 0; i < count; i++) {
+        std::launder(slot_address(head + i))->~T();
+      }
     }
-    new (pop_value_) T(*(that.pop_value_));
+    head_.store(head + count, std::memory_order_release);
+    return count;
   }
 
-  ~ringqueue() {
-    for (size_t i = head_; i != tail_; ++i)
-      (&queue_[i & capacityMask_])->~T();
-    (pop_value_)->~T();
-    delete[] reinterpret_cast<char *>(queue_);
-    delete[] reinterpret_cast<char *>(pop_value_);
-  }
-  size_t capacity() const { return capacity_; }
-  size_t size() const {
-    size_t head = head_.load(std::memory_order_acquire);
-    return tail_.load(std::memory_order_relaxed) - head;
-  }
-
-  bool push(const T &p_data) {
-    T *node;
-    size_t tail = tail_.load(std::memory_order_relaxed);
-    size_t head = head_.load(std::memory_order_acquire);
-    node = &queue_[tail & capacityMask_];
-    memset(node, 0, sizeof(T));
-    new (node) T(p_data);
-    if (tail - head < capacity_ - 1) {
-      tail_++;
+  /**
+   * called by consumer, move the front element out
+   * @return false if the queue is empty
+   */
+  bool pop(T &result) {
+    if (available() == 0) {
+      return false;
     }
+    result = std::move(at(0));
+    pop(1);
     return true;
   }
 
-  bool pop(T *&result) {
-    T *node;
-    result = nullptr;
-    size_t head = head_.load(std::memory_order_relaxed);
-    size_t tail = tail_.load(std::memory_order_acquire);
-    if (head >= tail) {
-      // std::cout << "pop empty queue..........................." << std::endl;
-      return false;
+private:
+  typedef std::aligned_storage_t<sizeof(T), alignof(T)> slot;
+
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<slot[]> slots_;
+  /** written by consumer only, along with its cached copy of tail */
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_ = 0;
+  size_t tail_cache_ = 0;
+  /** written by producer only, along with its cached copy of head */
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_ = 0;
+  size_t head_cache_ = 0;
+
+  static size_t round_up(size_t capacity) {
+    size_t result = 1;
+    while (result < capacity) {
+      result <<= 1u;
     }
-    node = &queue_[head & capacityMask_];
-    memset(pop_value_, 0, sizeof(T));
-    *pop_value_ = *node;
-    result = pop_value_;
-    node->~T();
-    head_++;
-    // std::cout << "pop " << result << " head<<" << head_ << " tail<<" << tail_ << std::endl;
-    return true;
+    return result;
   }
 
-private:
-  size_t capacityMask_;
-  T *queue_;
-  T *pop_value_;
-  size_t capacity_;
-  std::atomic<size_t> tail_;
-  std::atomic<size_t> head_;
+  T *slot_address(size_t position) { return reinterpret_cast<T *>(&slots_[position & mask_]); }
 };
-} // namespace kungfu::yijinjing::cache
\ No newline at end of file
+} // namespace kungfu::yijinjing::cache
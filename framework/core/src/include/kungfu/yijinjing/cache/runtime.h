@@ -74,20 +74,30 @@ private:
   DataTypesMap state_map_;
 };
 
+/**
+ * states of TradingDataTypes kept in order in bounded rings of TRADING_MAP_RING_SIZE each, for one producer thread and
+ * one consumer thread, a state is not taken if its ring is full
+ */
 class trading_bank {
 public:
   trading_bank()
       : trading_data_map_(longfist::build_ring_state_map(longfist::TradingDataTypes, longfist::TRADING_MAP_RING_SIZE)) {
   }
-  template <typename DataType> void operator<<(const state<DataType> &state) {
+
+  trading_bank(const trading_bank &) = delete;
+
+  trading_bank &operator=(const trading_bank &) = delete;
+
+  /** @return false if the ring is full */
+  template <typename DataType> bool operator<<(const state<DataType> &state) {
     auto &target_queue = trading_data_map_[boost::hana::type_c<DataType>];
-    target_queue->push(state);
+    return target_queue->push(state);
   }
 
-  template <typename DataType> void operator<<(const typed_event_ptr<DataType> &event) {
+  /** @return false if the ring is full */
+  template <typename DataType> bool operator<<(const typed_event_ptr<DataType> &event) {
     auto &target_queue = trading_data_map_[boost::hana::type_c<DataType>];
-    kungfu::state<DataType> s(*event);
-    target_queue->push(s);
+    return target_queue->emplace(*event);
   }
 
   template <typename DataType>
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef KUNGFU_CACHE_SNAPSHOT_H
+#define KUNGFU_CACHE_SNAPSHOT_H
+
+#include <algorithm>
+#include <atomic>
+
+#include <kungfu/common.h>
+#include <kungfu/yijinjing/common.h>
+
+namespace kungfu::yijinjing::cache {
+
+/**
+ * header of snapshot file, followed by records of fixed size, each a snapshot_record and the data
+ */
+struct snapshot_header {
+  char magic[8];
+  int32_t msg_type;
+  uint32_t data_size;
+  /** records written, a record counts only after it is written in full, read by other processes without lock */
+  std::atomic<uint64_t> record_count;
+  uint64_t reserved[5];
+};
+
+struct snapshot_record {
+  uint64_t uid;
+  uint64_t reserved;
+};
+
+/**
+ * append-only store of fixed size data keyed by uid, in file {dest_id:08x}.{type_name}.snapshot mapped in memory.
+ * Putting data with a uid already stored appends a new record and leaves the old one stale, stale records are dropped
+ * by compaction once they outnumber live ones, checked when the file is full and every SNAPSHOT_COMPACTION_INTERVAL.
+ */
+class snapshot {
+public:
+  /**
+   * @param is_writing false to map the file read only, for readers in other processes than the one putting data
+   */
+  snapshot(std::string path, int32_t msg_type, uint32_t data_size, bool is_writing = true);
+
+  ~snapshot();
+
+  void put(uint64_t uid, const void *data);
+
+  void clear();
+
+  [[nodiscard]] size_t size() const { return index_.size(); }
+
+  /**
+   * call handler with address of each live data, in the order they are put
+   */
+  template <typename Handler> void for_each(Handler &&handler) const {
+    auto count = record_count();
+    for (uint64_t n = 0; n < count; n++) {
+      auto record = reinterpret_cast<const snapshot_record *>(record_address(n));
+      auto it = index_.find(record->uid);
+      if (it != index_.end() and it->second == n) {
+        handler(reinterpret_cast<const void *>(record_address(n) + sizeof(snapshot_record)));
+      }
+    }
+  }
+
+  /**
+   * rewrite the file with live records only
+   */
+  void compact();
+
+  static std::string get_path(const data::location_ptr &location, uint32_t dest_id, const std::string &type_name);
+
+private:
+  const std::string path_;
+  const int32_t msg_type_;
+  const uint32_t data_size_;
+  const size_t record_size_;
+  const bool is_writing_;
+  uintptr_t address_ = 0;
+  size_t mapped_size_ = 0;
+  /** record number of live data by uid */
+  std::unordered_map<uint64_t, uint64_t> index_ = {};
+  int64_t next_compaction_time_ = 0;
+
+  [[nodiscard]] snapshot_header *header() const { return reinterpret_cast<snapshot_header *>(address_); }
+
+  [[nodiscard]] uintptr_t record_address(uint64_t n) const {
+    return address_ + sizeof(snapshot_header) + n * record_size_;
+  }
+
+  /** the last byte of file is never used, it gets rewritten when the file is mapped */
+  [[nodiscard]] uint64_t record_capacity() const {
+    return mapped_size_ > sizeof(snapshot_header) ? (mapped_size_ - sizeof(snapshot_header) - 1) / record_size_ : 0;
+  }
+
+  /** records readable in the mapped range, a reader may have mapped less than the writer has grown the file to */
+  [[nodiscard]] uint64_t record_count() const {
+    return address_ == 0 ? 0 : std::min(header()->record_count.load(std::memory_order_acquire), record_capacity());
+  }
+
+  void map(const std::string &path, size_t size);
+
+  void unmap();
+
+  void reset();
+
+  void load();
+};
+
+DECLARE_PTR(snapshot)
+} // namespace kungfu::yijinjing::cache
+
+#endif // KUNGFU_CACHE_SNAPSHOT_H
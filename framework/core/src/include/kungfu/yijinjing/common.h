@@ -59,13 +59,15 @@ FORWARD_DECLARE_STRUCT_PTR(location)
 FORWARD_DECLARE_CLASS_PTR(locator)
 typedef std::unordered_map<uint32_t, location_ptr> location_map;
 
+class locator_index;
+
 class locator {
 public:
   locator();
 
   explicit locator(longfist::enums::mode m, const std::vector<std::string> &tag = {});
 
-  explicit locator(const std::string &root) : root_(root), dir_mode_(longfist::enums::mode::LIVE) {}
+  explicit locator(const std::string &root);
 
   virtual ~locator() = default;
 
@@ -91,11 +93,18 @@ public:
 
   [[nodiscard]] virtual std::vector<uint32_t> list_location_dest_by_db(const location_ptr &location) const;
 
+  /**
+   * tell the index about a page just created, so that it shows up without waiting for filesystem events
+   */
+  void register_page(const location_ptr &location, uint32_t dest_id, uint32_t page_id) const;
+
   bool operator==(const locator &another) const;
 
 private:
   std::filesystem::path root_;
   longfist::enums::mode dir_mode_;
+  /** journal directories and pages under root, shared by locators of the same root */
+  std::shared_ptr<locator_index> index_;
 };
 
 struct location : public std::enable_shared_from_this<location>, public longfist::types::Location {
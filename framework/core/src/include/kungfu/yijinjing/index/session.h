@@ -17,6 +17,9 @@ namespace kungfu::yijinjing::index {
 typedef std::vector<longfist::types::Session> SessionVector;
 typedef std::unordered_map<uint32_t, longfist::types::Session> SessionMap;
 
+/** frames are counted in memory, live sessions are written to index db at most once per interval */
+constexpr int64_t SESSION_CHECKPOINT_INTERVAL = 10 * time_unit::NANOSECONDS_PER_SECOND;
+
 class session_finder {
 public:
   explicit session_finder(const yijinjing::io_device_ptr &io_device);
@@ -47,12 +50,39 @@ public:
 
   SessionMap &close_all_sessions(int64_t time);
 
+  /**
+   * count frame into its session in memory, checkpoints before counting it once SESSION_CHECKPOINT_INTERVAL passes
+   */
   void update_session(const journal::frame_ptr &frame);
 
-  [[maybe_unused]] void rebuild_index_db();
+  /**
+   * write sessions, along with read position of journals they are indexed from, to index db in one transaction.
+   * Journals of open sessions are taken as read up to given time, so that rebuild_index_db resumes from there.
+   */
+  void checkpoint(int64_t time);
+
+  /**
+   * index journals from where the last checkpoint left off, journals without checkpoint are read from start.
+   * Without any checkpoint, or if full is set, the index db is rebuilt from scratch. Journals are partitioned by the
+   * location whose sessions they affect, partitions are indexed in parallel on up to hardware_concurrency threads.
+   */
+  [[maybe_unused]] void rebuild_index_db(bool full = false);
 
 private:
   SessionMap live_sessions_ = {};
+  /** keyed by location uid in high 32 bits and dest id in low 32 bits */
+  std::unordered_map<uint64_t, longfist::types::SessionCheckpoint> checkpoints_ = {};
+  int64_t next_checkpoint_time_ = 0;
+
+  /**
+   * move read position of journals the session is indexed from to given time, frames before it are counted
+   */
+  void advance_checkpoints(const longfist::types::Session &session, int64_t time);
+
+  /**
+   * restore checkpoints and sessions not closed yet, clear index db if there is no checkpoint
+   */
+  void load_checkpoints();
 };
 } // namespace kungfu::yijinjing::index
 
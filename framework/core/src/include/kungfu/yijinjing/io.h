@@ -34,6 +34,9 @@ public:
 
   [[nodiscard]] bool is_low_latency() const { return low_latency_; }
 
+  /** writers opened by this device accept frames from multiple threads, enabled by env KF_JOURNAL_MULTI_PRODUCER */
+  [[nodiscard]] bool is_multi_producer() const { return multi_producer_; }
+
   journal::reader_ptr open_reader_to_subscribe();
 
   [[maybe_unused]] journal::reader_ptr open_reader(const data::location_ptr &location, uint32_t dest_id);
@@ -58,6 +61,7 @@ protected:
   data::location_ptr live_home_;
   const bool low_latency_;
   const bool lazy_;
+  const bool multi_producer_;
   nanomsg::url_factory_ptr url_factory_;
   publisher_ptr publisher_;
   observer_ptr observer_;
@@ -91,9 +95,22 @@ public:
 
   [[maybe_unused]] void show(int64_t begin_time, int64_t end_time, bool in, bool out, std::string csv);
 
+  /**
+   * trace frames into one columnar binary file per msg type, {output_dir}/{type_name}.kfcol, with fixed width
+   * columns gen_time, trigger_time, source, dest followed by fields of the type, for fast loading into numpy/pandas
+   */
+  [[maybe_unused]] void export_columns(int64_t begin_time, int64_t end_time, bool in, bool out,
+                                       const std::string &output_dir);
+
 private:
   int32_t console_width_;
   int32_t console_height_;
+
+  journal::reader_ptr open_trace_reader(int64_t begin_time, bool in, bool out);
+
+  /** join journals that the traced location starts reading from, or disjoin those it stops */
+  void follow_trace_requests(const journal::reader_ptr &reader, const journal::frame_ptr &frame,
+                             const std::unordered_map<uint32_t, data::location_ptr> &locations);
 };
 
 DECLARE_PTR(io_device_console)
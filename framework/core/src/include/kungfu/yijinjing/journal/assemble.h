@@ -10,12 +10,27 @@
 #include <kungfu/yijinjing/journal/journal.h>
 
 namespace kungfu::yijinjing::journal {
+/**
+ * header and data of a frame in place, pointing into the mapped page, valid until assemble moves to the next frame
+ */
+struct frame_span {
+  const longfist::types::frame_header *header;
+  const uint8_t *data;
+  uint32_t length;
+};
+
 class sink {
 public:
   sink();
   virtual ~sink() = default;
   virtual void put(const data::location_ptr &location, uint32_t dest_id, const frame_ptr &frame) = 0;
   virtual void close(){};
+  /**
+   * whether what the sink makes of frames from one location/dest does not depend on frames from others,
+   * if so, assemble feeds frames of different location/dest from multiple threads at the same time,
+   * frames of the same location/dest are still put in order from a single thread
+   */
+  [[nodiscard]] virtual bool is_partitionable() const { return false; }
   [[nodiscard]] publisher_ptr get_publisher();
 
 private:
@@ -33,9 +48,11 @@ class [[maybe_unused]] copy_sink : public sink {
 public:
   explicit copy_sink(data::locator_ptr locator);
   void put(const data::location_ptr &location, uint32_t dest_id, const frame_ptr &frame) override;
+  [[nodiscard]] bool is_partitionable() const override { return true; }
 
 private:
   data::locator_ptr locator_;
+  std::mutex writers_mutex_ = {};
   std::unordered_map<uint32_t, std::unordered_map<uint32_t, writer_ptr>> writers_ = {};
 };
 
@@ -64,7 +81,7 @@ public:
 
   void next();
 
-  frame_ptr current_frame();
+  const frame_ptr &current_frame();
 
   template <typename T>
   [[maybe_unused]] std::vector<T> read_all(int32_t msg_type = T::tag, int64_t end_time = INT64_MAX) {
@@ -102,6 +119,16 @@ public:
     return read_header_data<T>(T::tag, end_time);
   }
 
+  /**
+   * visit frames of given msg type (0 for all) in place without copying, spans are only valid during the visit
+   */
+  void read_spans(int32_t msg_type, int64_t end_time, const std::function<void(const frame_span &)> &visit);
+
+  template <typename T>
+  [[maybe_unused]] void read_spans(const T &, int64_t end_time, const std::function<void(const frame_span &)> &visit) {
+    read_spans(T::tag, end_time, visit);
+  }
+
   std::vector<std::pair<longfist::types::frame_header, std::vector<uint8_t>>> read_bytes(int32_t msg_type,
                                                                                          int64_t end_time = INT64_MAX);
 
@@ -142,6 +169,11 @@ private:
   int64_t from_time_ = 0;
 
   void sort();
+
+  /**
+   * merge journals of each location/dest separately, partitions go to sink in parallel
+   */
+  void put_partitioned(const sink_ptr &sink);
 };
 DECLARE_PTR(assemble)
 } // namespace kungfu::yijinjing::journal
@@ -81,7 +81,10 @@ private:
 
   void move_to_next() { set_address(address() + frame_length()); }
 
-  void set_header_length() { header_->header_length = sizeof(longfist::types::frame_header); }
+  /** padding goes between header and data, for frames published shorter than the space they occupy */
+  void set_header_length(uint32_t padding = 0) {
+    header_->header_length = sizeof(longfist::types::frame_header) + padding;
+  }
 
   void set_data_length(uint32_t length) { header_->length = header_length() + length; }
 
@@ -3,7 +3,12 @@
 #ifndef YIJINJING_JOURNAL_H
 #define YIJINJING_JOURNAL_H
 
+#include <atomic>
+#include <future>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <kungfu/common.h>
 #include <kungfu/longfist/longfist.h>
@@ -46,6 +51,14 @@ public:
    */
   void seek_to_time(int64_t nanotime);
 
+  /**
+   * once writer passes this fraction of the page, the next page is created, mapped and pre-faulted by a helper thread
+   * under a temporary name, so that page rollover does not stall, values out of (0, 1) disable preloading.
+   * defaults to env KF_PAGE_PRELOAD_THRESHOLD if set, otherwise 0.5
+   * @param threshold fraction of page size
+   */
+  static void set_page_preload_threshold(double threshold);
+
 private:
   const data::location_ptr location_;
   const uint32_t dest_id_;
@@ -54,12 +67,20 @@ private:
   page_ptr page_;
   frame_ptr frame_;
   uint64_t page_frame_nb_;
+  /** frame address that triggers next page preloading, UINTPTR_MAX if not needed */
+  uintptr_t preload_address_ = UINTPTR_MAX;
+  std::future<page_ptr> next_page_ = {};
 
-  void load_page(int page_id);
+  void load_page(uint32_t page_id);
 
   /** load next page, current page will be released if not empty */
   void load_next_page();
 
+  /** ask the process wide preloader for the next page, writers only */
+  void preload_next_page();
+
+  page_ptr take_preloaded_page();
+
   friend class reader;
 
   friend class writer;
@@ -83,9 +104,9 @@ public:
 
   void disjoin_channel(uint32_t location_uid, uint32_t dest_id);
 
-  [[nodiscard]] frame_ptr current_frame() const { return current_->current_frame(); }
+  [[nodiscard]] const frame_ptr &current_frame() const { return current_->current_frame(); }
 
-  [[nodiscard]] page_ptr current_page() const { return current_->current_page(); }
+  [[nodiscard]] const page_ptr &current_page() const { return current_->current_page(); }
 
   [[maybe_unused]] [[nodiscard]] const std::unordered_map<uint64_t, journal> &journals() const { return journals_; }
 
@@ -103,11 +124,30 @@ private:
   const bool lazy_;
   journal *current_;
   std::unordered_map<uint64_t, journal> journals_;
+  /** min-heap on current frame gen_time of journals that have data to read */
+  std::vector<journal *> heap_ = {};
+  /** journals waiting at the tail for writers to publish their next frame */
+  std::vector<journal *> idle_ = {};
+  /** last time point fetched from clock, frames generated before it need no further clock check */
+  int64_t now_ = 0;
+
+  void push(journal *j);
+
+  void poll_idle();
+
+  void rebuild();
+
+  friend class assemble;
 };
 
 class writer {
 public:
-  writer(const data::location_ptr &location, uint32_t dest_id, bool lazy, publisher_ptr publisher);
+  /**
+   * @param multi_producer allow frames to be written from multiple threads at the same time, frames are reserved
+   * lock-free and published in reservation order. Each thread can have only one frame open per writer.
+   */
+  writer(const data::location_ptr &location, uint32_t dest_id, bool lazy, publisher_ptr publisher,
+         bool multi_producer = false);
 
   [[nodiscard]] const data::location_ptr &get_location() const { return journal_.location_; }
 
@@ -115,7 +155,9 @@ public:
 
   [[nodiscard]] const journal &get_journal() const { return journal_; }
 
-  [[nodiscard]] const page_ptr get_current_page() const { return journal_.page_; }
+  [[nodiscard]] const page_ptr get_current_page() const;
+
+  [[nodiscard]] bool is_multi_producer() const { return multi_producer_; }
 
   uint64_t current_frame_uid();
 
@@ -148,6 +190,16 @@ public:
 
   void close_data();
 
+  /**
+   * frames written from now on until end_batch are published all at once, with a single page header update and a
+   * single notification, e.g. for basket orders or bursts of ticks. Frames of a batch are published early if page
+   * rolls over in between. In multi-producer mode frames are still published one by one. Writer stays locked for the
+   * calling thread until end_batch, other threads wait for it, see batch_guard.
+   */
+  void begin_batch();
+
+  void end_batch();
+
   template <typename T>
   std::enable_if_t<size_fixed_v<T>> write(int64_t trigger_time, const T &data, int32_t msg_type = T::tag) {
     auto frame = open_frame(trigger_time, msg_type, sizeof(T));
@@ -207,8 +259,90 @@ private:
   publisher_ptr publisher_;
   size_t size_to_write_;
   uint32_t writer_start_time_32int_;
+  /** max gen_time of frames written to current page, for page frame index */
+  int64_t page_max_gen_time_;
+  /** thread that holds the writer for a batch, default id if there is no batch open */
+  std::atomic<std::thread::id> batch_owner_ = {};
+  /** first frame of current batch, written in full except for its length, which is set last to publish the batch */
+  uintptr_t batch_frame_address_ = 0;
+  uint32_t batch_data_length_ = 0;
+  uint64_t batch_last_frame_position_ = 0;
+
+  /** frame index sample taken in a batch, recorded on flush so that no sample points to a frame not published */
+  struct index_sample {
+    uint64_t frame_nb;
+    uintptr_t frame_address;
+    int64_t max_gen_time;
+  };
+  std::vector<index_sample> batch_index_samples_ = {};
+
+  /** frame reserved by a producer thread in multi-producer mode */
+  struct reservation {
+    frame_ptr frame;
+    uint32_t page_id;
+    uint64_t offset;
+    uint32_t data_length;
+  };
+
+  const bool multi_producer_;
+  const uint32_t page_size_;
+  /** unique in process, identifies the writer in thread local caches where its address may be reused by another */
+  const uint64_t serial_;
+  /** reservations of producer threads, node based so that references handed out stay valid */
+  std::unordered_map<std::thread::id, reservation> reservations_ = {};
+  std::mutex reservations_mtx_ = {};
+  /** page id in high 32 bits and offset of the next frame to reserve in low 32 bits */
+  std::atomic<uint64_t> reserve_cursor_ = 0;
+  /** offset of the next frame to publish, frames get published in the order they are reserved */
+  std::atomic<uint64_t> commit_position_ = 0;
+  /** gen_time of the last frame published in multi-producer mode, gen_time never goes back in a journal */
+  int64_t last_gen_time_ = 0;
+  /** guards page switch against get_current_page in multi-producer mode */
+  mutable std::mutex page_mtx_ = {};
+
+  void lock_writer();
+
+  [[nodiscard]] bool in_batch() const;
 
   void close_page(int64_t trigger_time);
+
+  void flush_batch();
+
+  void index_frame(const frame_ptr &frame);
+
+  reservation &local_reservation();
+
+  frame_ptr reserve_frame(int64_t trigger_time, int32_t msg_type, uint32_t data_length);
+
+  void commit_frame(size_t data_length, int64_t gen_time);
+
+  /** close page on behalf of all producers, called by the one whose reservation crosses page border first */
+  void roll_page(uint64_t offset, int64_t trigger_time);
+
+  void wait_for_commit(uint64_t offset);
+};
+
+/**
+ * batch of given writer for the lifetime of the guard, ended even if writing throws so that the writer gets unlocked
+ */
+class batch_guard {
+public:
+  explicit batch_guard(writer &w) : writer_(w) { writer_.begin_batch(); }
+
+  batch_guard(const batch_guard &) = delete;
+
+  batch_guard &operator=(const batch_guard &) = delete;
+
+  ~batch_guard() {
+    try {
+      writer_.end_batch();
+    } catch (const std::exception &ex) {
+      SPDLOG_ERROR("failed to end batch of {}, {}", writer_.get_location()->uname, ex.what());
+    }
+  }
+
+private:
+  writer &writer_;
 };
 } // namespace kungfu::yijinjing::journal
 #endif // YIJINJING_JOURNAL_H
@@ -3,6 +3,8 @@
 #ifndef YIJINJING_PAGE_H
 #define YIJINJING_PAGE_H
 
+#include <atomic>
+
 #include <kungfu/yijinjing/journal/common.h>
 #include <kungfu/yijinjing/journal/frame.h>
 
@@ -17,6 +19,65 @@ namespace kungfu::yijinjing::journal {
 //     (uint64_t, last_frame_position)           //
 //);
 
+/**
+ * record of a closed page, appended by writer to the sidecar index file {dest_id:08x}.index next to the pages
+ */
+struct page_index_entry {
+  uint32_t page_id;
+  uint32_t reserved;
+  int64_t begin_time;
+  int64_t end_time;
+};
+
+/**
+ * sample of every FRAME_INDEX_INTERVAL-th frame of a page, kept in sidecar file {dest_id:08x}.{page_id}.index,
+ * max_gen_time covers all frames up to the sampled one, so that it stays sorted even if gen_time goes back
+ */
+struct frame_index_entry {
+  int64_t max_gen_time;
+  /** offset of the sampled frame from page address, 0 means not sampled yet */
+  volatile uint64_t offset;
+};
+
+/**
+ * header of archived page file {dest_id:08x}.{page_id}.zjournal, followed by block_count compressed_block entries,
+ * then the blocks themselves in order, decompressed back to back they make up the beginning of the page
+ */
+struct compressed_page_header {
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t block_size;
+  uint32_t block_count;
+  int64_t begin_time;
+  int64_t end_time;
+};
+
+/** block that does not shrink is stored as is, with compressed_length equal to data_length */
+struct compressed_block {
+  uint32_t data_length;
+  uint32_t compressed_length;
+};
+
+constexpr uint32_t COMPRESSED_BLOCK_SIZE = 4 * MB;
+
+/**
+ * outcome of walking the frame chain of a page, see page::verify
+ */
+struct page_verify_result {
+  uint64_t frame_count;
+  /** offset right after the last valid frame */
+  uint64_t end_position;
+  /** chain ends with a frame that has length set but is not valid, i.e. the page is torn */
+  bool torn;
+  /** chain ends with PageEnd */
+  bool closed;
+};
+
+constexpr uint32_t FRAME_INDEX_INTERVAL = 1024;
+
+/** pages smaller than this are scanned fast enough, they get no frame index */
+constexpr uint32_t FRAME_INDEX_MIN_PAGE_SIZE = 16 * MB;
+
 class page {
 public:
   ~page();
@@ -47,6 +108,11 @@ public:
 
   [[nodiscard]] uintptr_t last_frame_address() const { return address() + header_->last_frame_position; }
 
+  /** no frame written yet, e.g. preloaded by writer ahead of rollover */
+  [[nodiscard]] bool is_empty() const {
+    return reinterpret_cast<longfist::types::frame_header *>(first_frame_address())->length == 0;
+  }
+
   [[nodiscard]] bool is_full() const {
     return last_frame_address() + reinterpret_cast<longfist::types::frame_header *>(last_frame_address())->length >
            address_border();
@@ -55,10 +121,72 @@ public:
   static page_ptr load(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id, bool is_writing,
                        bool lazy);
 
+  /**
+   * create and map a page for writer under temporary name {page file}.preload, so that nobody else sees it until the
+   * writer switches to it by publish()
+   */
+  static page_ptr preload(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id, bool lazy);
+
+  /**
+   * give a preloaded page its real name, fails if the real page exists meanwhile
+   */
+  bool publish();
+
+  /**
+   * mmap hints (os::MMAP_*) used to load pages of given category, none by default. Initial values are taken from env
+   * KF_PAGE_MMAP_POPULATE and KF_PAGE_MMAP_HUGE_PAGES, each a comma separated list of category names, e.g. "md,td"
+   */
+  static void set_mmap_hints(longfist::enums::category category, uint32_t hints);
+
+  static uint32_t get_mmap_hints(longfist::enums::category category);
+
+  /**
+   * keep checksum of every frame written from now on in sidecar file {dest_id:08x}.{page_id}.sum, to detect torn
+   * frames that have headers in place but content lost. Initial value is taken from env KF_JOURNAL_CHECKSUM
+   */
+  static void set_frame_checksum(bool enabled);
+
   static std::string get_page_path(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id);
 
+  static std::string get_compressed_page_path(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id);
+
+  /** whether the page exists, either as is or compressed */
+  static bool exists(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id);
+
+  /**
+   * archive a closed page into compressed file and remove the original one, readers load compressed pages
+   * transparently, by decompressing them into memory
+   * @return false if the page does not exist or is not closed yet
+   */
+  static bool compress(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id);
+
+  /**
+   * walk the frame chain from the first frame, until a frame is not published yet, or not valid: header out of page,
+   * header length mismatch, or checksum mismatch if there is one
+   */
+  static page_verify_result verify(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id);
+
   static uint32_t find_page_id(const data::location_ptr &location, uint32_t dest_id, int64_t time);
 
+  /**
+   * find the latest sampled frame that all frames before it are generated no later than given time,
+   * frames before it can be skipped when seeking to time
+   * @return frame number in page and address of the sampled frame, 0 and first frame address if not found
+   */
+  std::pair<uint64_t, uintptr_t> seek_frame_index(int64_t time);
+
+  static std::string get_page_index_path(const data::location_ptr &location, uint32_t dest_id);
+
+  /**
+   * read index entries of closed pages, empty if the index is missing or not contiguous
+   */
+  static std::vector<page_index_entry> load_page_index(const data::location_ptr &location, uint32_t dest_id);
+
+  /**
+   * drop index entries of pages from given page id on, they are left by previous writers and no longer valid
+   */
+  static void trim_page_index(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id);
+
 private:
   const data::location_ptr location_;
   const uint32_t dest_id_;
@@ -66,14 +194,91 @@ private:
   const bool lazy_;
   const size_t size_;
   const longfist::types::page_header *header_;
+  frame_index_entry *frame_index_ = nullptr;
+  size_t frame_index_capacity_ = 0;
+  bool frame_index_loaded_ = false;
+  /** checksum of frame at offset n * sizeof(frame_header), 0 for none */
+  volatile uint32_t *checksums_ = nullptr;
+  size_t checksums_capacity_ = 0;
+  /** temporary file of a page preloaded but not published yet, removed along with the page if never published */
+  std::string preload_path_ = {};
 
   page(data::location_ptr location, uint32_t dest_id, uint32_t page_id, size_t size, bool lazy, uintptr_t address);
 
+  /**
+   * map frame index sidecar file, writer creates it if missing while readers go without it
+   * @param reset clear existing samples, used when the page is newly created
+   */
+  void load_frame_index(bool is_writing, bool reset);
+
+  /**
+   * map sidecar file {dest_id:08x}.{page_id}.{name}, 0 if not available
+   * @param reset remove existing file first
+   */
+  uintptr_t load_sidecar(const std::string &name, size_t size, bool is_writing, bool reset);
+
+  void load_checksums(bool is_writing, bool reset);
+
+  /**
+   * record checksum for frame about to be published with given data length, gen_time must be set already
+   */
+  void set_checksum(uintptr_t frame_address, uint32_t data_length) {
+    auto slot = (frame_address - address()) / sizeof(longfist::types::frame_header);
+    if (checksums_ != nullptr and slot < checksums_capacity_) {
+      checksums_[slot] = checksum(frame_address, data_length);
+    }
+  }
+
+  static uint32_t checksum(uintptr_t frame_address, uint32_t data_length);
+
+  [[nodiscard]] bool is_valid_frame(uintptr_t frame_address) const;
+
+  /**
+   * make the tail of page consistent for writer to append, drops frames lost in a crash and clears what follows,
+   * only frames around last_frame_position are checked, so that it costs little on every restart
+   */
+  void recover_tail();
+
+  /**
+   * record sample for given frame number if it falls on FRAME_INDEX_INTERVAL,
+   * samples are kept as a contiguous run from the first frame, those after a missing one are dropped
+   */
+  void set_frame_index(uint64_t frame_nb, uintptr_t frame_address, int64_t max_gen_time) {
+    auto n = frame_nb / FRAME_INDEX_INTERVAL;
+    bool sampled = frame_nb % FRAME_INDEX_INTERVAL == 0 and n < frame_index_capacity_;
+    if (sampled and (n == 0 or frame_index_[n - 1].offset != 0)) {
+      auto &entry = frame_index_[n];
+      entry.max_gen_time = max_gen_time;
+      std::atomic_thread_fence(std::memory_order_release); // offset marks the entry valid, publish it at last
+      entry.offset = frame_address - address();
+    }
+  }
+
   /**
    * update page header when new frame added
    */
   void set_last_frame_position(uint64_t position);
 
+  /**
+   * append time range of this page to page index, called by writer when the page is closed
+   */
+  void append_page_index() const;
+
+  /**
+   * read gen_time of the first frame in page without mapping it, 0 if the page is missing or has no frame yet
+   */
+  static int64_t find_begin_time(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id);
+
+  /**
+   * decompress archived page into anonymous memory
+   */
+  static uintptr_t load_compressed(const std::string &path, uint32_t page_size);
+
+  /**
+   * binary search page index for the page to start with, 0 if index is not usable
+   */
+  static uint32_t find_page_id_by_index(const data::location_ptr &location, uint32_t dest_id, int64_t time);
+
   friend class journal;
 
   friend class writer;
@@ -12,6 +12,8 @@
 
 #define LOG_LEVEL_ENV "KF_LOG_LEVEL"
 #define DEFAULT_LOG_LEVEL_NAME "info"
+/** set to 1 to format and write logs on a background thread */
+#define LOG_ASYNC_ENV "KF_LOG_ASYNC"
 #define TS_PATTERN "[%m/%d %H:%M:%S.%N] "
 #define LOG_PATTERN "[%^%=8l%$] [%6P/%-6t] [%s:%##%!] %v"
 
@@ -11,6 +11,7 @@
 #include <kungfu/yijinjing/io.h>
 #include <kungfu/yijinjing/practice/hero.h>
 #include <kungfu/yijinjing/time.h>
+#include <kungfu/yijinjing/util/timer_wheel.h>
 
 namespace kungfu::yijinjing::practice {
 class apprentice : public hero {
@@ -184,8 +185,23 @@ private:
   int64_t trading_day_ = 0;
   int32_t timer_usage_count_ = 0;
   std::unordered_map<int, int64_t> timer_checkpoints_ = {};
+
+  struct local_timer {
+    int32_t id;
+    int64_t duration;
+    bool repeat;
+    std::function<void(const event_ptr &)> callback;
+  };
+
+  /** timers added by add_timer and add_time_interval, keyed by request id, expired on Time events from master */
+  util::timer_wheel<local_timer> local_timers_ = {};
+
   void checkin();
 
+  void request_time(int32_t id, int64_t duration);
+
+  void on_time(const event_ptr &event);
+
   void expect_start();
 
   template <typename DataType> void do_read_from(const event_ptr &event, uint32_t dest_id) {
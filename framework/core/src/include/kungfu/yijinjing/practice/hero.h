@@ -28,6 +28,8 @@ inline yijinjing::data::location_ptr make_system_location(const std::string &gro
 
 typedef std::unordered_map<uint32_t, yijinjing::journal::writer_ptr> WriterMap;
 
+typedef std::function<void(const event_ptr &)> EventHandler;
+
 class hero : public resource {
 public:
   explicit hero(yijinjing::io_device_ptr io_device);
@@ -125,6 +127,23 @@ public:
 
   const rx::connectable_observable<event_ptr> &get_events() const;
 
+  /** matches any source or dest in routes */
+  static constexpr uint32_t ROUTE_ANY = UINT32_MAX;
+
+  /**
+   * call handler for events of given msg_type from source to dest, right after they are pushed to rx subscribers.
+   * Routes are looked up once per event in a table hashed by msg_type, instead of every subscription filtering every
+   * event. Exceptions thrown by handler stop the event loop as rx errors do.
+   * @return route id for unroute
+   */
+  uint64_t route(int32_t msg_type, uint32_t source, uint32_t dest, EventHandler handler);
+
+  uint64_t route(int32_t msg_type, EventHandler handler) {
+    return route(msg_type, ROUTE_ANY, ROUTE_ANY, std::move(handler));
+  }
+
+  void unroute(uint64_t route_id);
+
 protected:
   int64_t begin_time_;
   int64_t end_time_;
@@ -183,29 +202,23 @@ protected:
   virtual void on_frame() = 0;
 
   static constexpr auto feed_profile_data = [](const event_ptr &event, auto &receiver) {
-    boost::hana::for_each(longfist::ProfileDataTypes, [&](auto it) {
-      using DataType = typename decltype(+boost::hana::second(it))::type;
-      if (DataType::tag == event->msg_type()) {
-        receiver << typed_event_ptr<DataType>(event);
-      }
+    longfist::dispatch(longfist::ProfileDataTypes, event->msg_type(), [&](auto type) {
+      using DataType = typename decltype(type)::type;
+      receiver << typed_event_ptr<DataType>(event);
     });
   };
 
   static constexpr auto feed_state_data = [](const event_ptr &event, auto &receiver) {
-    boost::hana::for_each(longfist::StateDataTypes, [&](auto it) {
-      using DataType = typename decltype(+boost::hana::second(it))::type;
-      if (DataType::tag == event->msg_type()) {
-        receiver << typed_event_ptr<DataType>(event);
-      }
+    longfist::dispatch(longfist::StateDataTypes, event->msg_type(), [&](auto type) {
+      using DataType = typename decltype(type)::type;
+      receiver << typed_event_ptr<DataType>(event);
     });
   };
 
   static constexpr auto feed_trading_data = [](const event_ptr &event, auto &receiver) {
-    boost::hana::for_each(longfist::TradingDataTypes, [&](auto it) {
-      using DataType = typename decltype(+boost::hana::second(it))::type;
-      if (DataType::tag == event->msg_type()) {
-        receiver << typed_event_ptr<DataType>(event);
-      }
+    longfist::dispatch(longfist::TradingDataTypes, event->msg_type(), [&](auto type) {
+      using DataType = typename decltype(type)::type;
+      receiver << typed_event_ptr<DataType>(event);
     });
   };
 
@@ -216,10 +229,28 @@ private:
   volatile bool continual_ = true;
   volatile bool live_ = false;
 
+  struct event_route {
+    uint64_t id;
+    uint32_t source;
+    uint32_t dest;
+    EventHandler handler;
+  };
+
+  std::unordered_map<int32_t, std::vector<event_route>> routes_ = {};
+  uint64_t last_route_id_ = 0;
+  /** set while calling route handlers, routes changed by handlers take effect once they all return */
+  bool routing_ = false;
+  std::vector<std::pair<int32_t, event_route>> pending_routes_ = {};
+  std::vector<uint64_t> pending_unroutes_ = {};
+
   void produce(const rx::subscriber<event_ptr> &sb);
 
   bool drain(const rx::subscriber<event_ptr> &sb);
 
+  void route_event(const event_ptr &event);
+
+  void apply_pending_routes();
+
   template <typename T>
   std::enable_if_t<T::reflect> do_require_read_from(yijinjing::journal::writer_ptr &&writer, int64_t trigger_time,
                                                     uint32_t dest_id, uint32_t source_id, int64_t from_time) {
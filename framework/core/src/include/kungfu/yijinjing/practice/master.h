@@ -11,6 +11,7 @@
 #include <kungfu/yijinjing/journal/common.h>
 #include <kungfu/yijinjing/practice/hero.h>
 #include <kungfu/yijinjing/practice/profile.h>
+#include <kungfu/yijinjing/util/timer_wheel.h>
 
 namespace kungfu::yijinjing::practice {
 
@@ -61,7 +62,8 @@ private:
   profile profile_;
 
   std::unordered_map<uint32_t, uint32_t> app_cmd_locations_ = {};
-  std::unordered_map<uint32_t, std::unordered_map<int32_t, timer_task>> timer_tasks_ = {};
+  /** keyed by app location uid in high 32 bits and request id in low 32 bits */
+  util::timer_wheel<timer_task> timer_tasks_ = {};
 
   void handle_timer_tasks();
 
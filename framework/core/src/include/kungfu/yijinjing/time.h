@@ -99,6 +99,16 @@ public:
    */
   static std::string strftime(int64_t nanotime, const std::string &format = KUNGFU_TIMESTAMP_FORMAT);
 
+  /**
+   * Format nano seconds into buffer without allocation, calendar part is rendered once per second and format.
+   * @param buffer output, not null terminated
+   * @param size buffer size
+   * @param nanotime nano time in int64_t
+   * @param format same as above
+   * @return length written, 0 if buffer is too small
+   */
+  static size_t strftime(char *buffer, size_t size, int64_t nanotime, const char *format);
+
   /**
    * Format now to string.
    * @param format ref: https://en.cppreference.com/w/cpp/io/manip/put_time + %N for nanoseconds {:09d}
@@ -119,6 +129,14 @@ public:
    */
   static void reset(int64_t system_clock_count, int64_t steady_clock_count);
 
+  /**
+   * Read steady clock from cpu time stamp counter for now_in_nano, saves a clock_gettime call each time.
+   * Only takes effect when TSC is invariant, initial value is taken from env KF_TSC_CLOCK.
+   * @param enabled whether to use TSC clock
+   * @return whether TSC clock is in use
+   */
+  static bool set_tsc_clock(bool enabled);
+
 private:
   time_point_info base_;
   time();
@@ -17,16 +17,35 @@
 #endif
 
 namespace kungfu::yijinjing::os {
+/** mmap hint: fault in the whole buffer while mapping */
+constexpr uint32_t MMAP_POPULATE = 0x1u;
+/** mmap hint: back the buffer by huge pages, falls back to normal pages if the system does not allow */
+constexpr uint32_t MMAP_HUGE_PAGES = 0x2u;
+
 /**
  * load mmap buffer, return address of the file-mapped memory
  * whether to write has to be specified in "is_writing"
  * buffer memory is locked if not lazy
+ * @param hints combination of MMAP_* flags
+ * @return the address of mapped memory
+ */
+uintptr_t load_mmap_buffer(const std::string &path, size_t size, bool is_writing = false, bool lazy = true,
+                           uint32_t hints = 0);
+
+/**
+ * map zero-filled memory not backed by any file, to be released by release_mmap_buffer as a lazy buffer
  * @return the address of mapped memory
  */
-uintptr_t load_mmap_buffer(const std::string &path, size_t size, bool is_writing = false, bool lazy = true);
+uintptr_t alloc_mmap_buffer(size_t size);
 
 bool release_mmap_buffer(uintptr_t address, [[maybe_unused]] size_t size, bool lazy);
 
+/**
+ * touch every memory page of a mapped buffer so that later access does not page fault,
+ * pages are written back with their own content if is_writing, to get write faults done as well
+ */
+void prefault_mmap_buffer(uintptr_t address, size_t size, bool is_writing);
+
 [[maybe_unused]] void disable_os_signals_handler();
 
 void handle_os_signals(void *hero);
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef KUNGFU_YIJINJING_TIMER_WHEEL_H
+#define KUNGFU_YIJINJING_TIMER_WHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include <kungfu/yijinjing/time.h>
+
+namespace kungfu::yijinjing::util {
+
+/**
+ * Hierarchical timing wheel, timers are keyed and carry a value of type T.
+ * Schedule and cancel cost O(1), advancing costs O(1) per expired timer plus cascading, empty ticks are skipped.
+ * A timer expires once its deadline <= now given to advance, regardless of tick resolution, which only affects how
+ * timers are spread over slots.
+ */
+template <typename T> class timer_wheel {
+public:
+  timer_wheel() : timer_wheel(time_unit::NANOSECONDS_PER_MILLISECOND) {}
+
+  explicit timer_wheel(int64_t resolution) : resolution_(std::max<int64_t>(resolution, 1)) {}
+
+  /**
+   * schedule timer with given key, replaces the existing one with the same key if any
+   */
+  void schedule(uint64_t key, int64_t deadline, T value) {
+    auto seq = ++last_seq_;
+    timers_.insert_or_assign(key, timer{deadline, seq, std::move(value)});
+    insert({key, seq, deadline});
+  }
+
+  bool cancel(uint64_t key) { return timers_.erase(key) > 0; }
+
+  /**
+   * cancel timers that predicate(key, value) returns true for, costs O(n) of timers scheduled
+   */
+  template <typename Predicate> void cancel_if(Predicate &&predicate) {
+    auto it = timers_.begin();
+    while (it != timers_.end()) {
+      it = predicate(it->first, it->second.value) ? timers_.erase(it) : std::next(it);
+    }
+  }
+
+  [[nodiscard]] bool contains(uint64_t key) const { return timers_.find(key) != timers_.end(); }
+
+  [[nodiscard]] size_t size() const { return timers_.size(); }
+
+  /**
+   * expire timers with deadline <= now, in the order of deadline and then scheduling, by calling fire(key, value).
+   * Expired timers are removed before fire is called, fire can schedule them again, those due already expire on next
+   * advance.
+   */
+  template <typename Fire> void advance(int64_t now, Fire &&fire) {
+    auto target = std::max(tick_of(now), current_tick_);
+    while (current_tick_ < target) {
+      collect(now);
+      current_tick_ = std::min(next_tick(), target);
+      cascade();
+      // only timers clamped to the wheel span are not due when their tick passes
+      for (const auto &entry : kept_) {
+        insert(entry);
+      }
+      kept_.clear();
+    }
+    collect(now);
+    auto &current = slots_[0][current_tick_ & (SLOTS - 1)];
+    current.insert(current.end(), kept_.begin(), kept_.end());
+    kept_.clear();
+    if (expired_.empty()) {
+      return;
+    }
+    std::sort(expired_.begin(), expired_.end(), [](const slot_entry &a, const slot_entry &b) {
+      return a.deadline < b.deadline or (a.deadline == b.deadline and a.seq < b.seq);
+    });
+    auto expired = std::move(expired_);
+    expired_ = {};
+    for (const auto &entry : expired) {
+      auto it = timers_.find(entry.key);
+      // fired timers may cancel or reschedule other expired ones
+      if (it == timers_.end() or it->second.seq != entry.seq) {
+        continue;
+      }
+      T value = std::move(it->second.value);
+      timers_.erase(it);
+      fire(entry.key, value);
+    }
+  }
+
+private:
+  static constexpr int SLOT_BITS = 6;
+  static constexpr int SLOTS = 1 << SLOT_BITS;
+  static constexpr int LEVELS = 8;
+  /** ticks are clamped to the end of current top level rotation, so that slots of the top level never wrap */
+  static constexpr int64_t ROTATION_MASK = (int64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+
+  struct timer {
+    int64_t deadline;
+    uint64_t seq;
+    T value;
+  };
+
+  /** slots keep seq along with key, entries left behind by cancelled or rescheduled timers are dropped when met */
+  struct slot_entry {
+    uint64_t key;
+    uint64_t seq;
+    int64_t deadline;
+  };
+
+  typedef std::vector<slot_entry> slot;
+
+  const int64_t resolution_;
+  /** ticks before it are all expired */
+  int64_t current_tick_ = 0;
+  uint64_t last_seq_ = 0;
+  std::unordered_map<uint64_t, timer> timers_ = {};
+  std::array<std::array<slot, SLOTS>, LEVELS> slots_ = {};
+  std::vector<slot_entry> expired_ = {};
+  std::vector<slot_entry> kept_ = {};
+
+  [[nodiscard]] int64_t tick_of(int64_t nanotime) const {
+    auto tick = nanotime / resolution_;
+    return tick * resolution_ > nanotime ? tick - 1 : tick;
+  }
+
+  [[nodiscard]] bool is_valid(const slot_entry &entry) const {
+    auto it = timers_.find(entry.key);
+    return it != timers_.end() and it->second.seq == entry.seq;
+  }
+
+  /**
+   * level is the highest slot-bits group that tick differs from current tick, so that a slot of level > 0 gets
+   * cascaded when current tick enters its range
+   */
+  void insert(const slot_entry &entry) {
+    auto tick = std::clamp(tick_of(entry.deadline), current_tick_, current_tick_ | ROTATION_MASK);
+    auto diff = static_cast<uint64_t>(tick ^ current_tick_);
+    int level = 0;
+    while (diff >= SLOTS) {
+      diff >>= SLOT_BITS;
+      level++;
+    }
+    slots_[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(entry);
+  }
+
+  /**
+   * move entries of current tick to expired if due, to kept otherwise
+   */
+  void collect(int64_t now) {
+    auto &current = slots_[0][current_tick_ & (SLOTS - 1)];
+    for (const auto &entry : current) {
+      if (is_valid(entry)) {
+        (entry.deadline <= now ? expired_ : kept_).push_back(entry);
+      }
+    }
+    current.clear();
+  }
+
+  /**
+   * the earliest tick after current that has a non-empty slot to expire or cascade, slots of each level before the
+   * current one are always empty
+   */
+  [[nodiscard]] int64_t next_tick() const {
+    for (int level = 0; level < LEVELS; level++) {
+      auto shift = SLOT_BITS * level;
+      auto index = (current_tick_ >> shift) & (SLOTS - 1);
+      for (auto i = index + 1; i < SLOTS; i++) {
+        if (not slots_[level][i].empty()) {
+          return ((current_tick_ >> (shift + SLOT_BITS)) << (shift + SLOT_BITS)) | (i << shift);
+        }
+      }
+    }
+    return INT64_MAX;
+  }
+
+  /**
+   * redistribute slots whose range starts at current tick, from higher levels down
+   */
+  void cascade() {
+    for (int level = LEVELS - 1; level > 0; level--) {
+      auto shift = SLOT_BITS * level;
+      if ((current_tick_ & ((int64_t(1) << shift) - 1)) != 0) {
+        continue;
+      }
+      auto &due = slots_[level][(current_tick_ >> shift) & (SLOTS - 1)];
+      if (due.empty()) {
+        continue;
+      }
+      slot entries = std::move(due);
+      due = {};
+      for (const auto &entry : entries) {
+        if (is_valid(entry)) {
+          insert(entry);
+        }
+      }
+    }
+  }
+};
+} // namespace kungfu::yijinjing::util
+
+#endif // KUNGFU_YIJINJING_TIMER_WHEEL_H
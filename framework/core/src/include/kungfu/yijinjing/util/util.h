@@ -28,6 +28,18 @@ void color_print(const std::string &level, const std::string &log);
 bool in_color_terminal();
 
 size_t get_thread_id();
+
+/**
+ * compress with a LZ77 codec in the style of LZ4 block format, trades ratio for speed
+ * @return compressed length, 0 if it does not fit in capacity
+ */
+size_t lz_compress(const uint8_t *source, size_t length, uint8_t *dest, size_t capacity);
+
+/**
+ * decompress data produced by lz_compress
+ * @return decompressed length, 0 if source is corrupted or does not fit in capacity
+ */
+size_t lz_decompress(const uint8_t *source, size_t length, uint8_t *dest, size_t capacity);
 } // namespace kungfu::yijinjing::util
 
 #endif // KUNGFU_YIJINJING_UTIL_H
@@ -86,24 +86,33 @@ void Runner::post_start() {
       $$(invoke(&Strategy::on_entrust, event->data<Entrust>(), get_location(event->source())));
   events_ | is_own<Transaction>(context_->get_broker_client()) |
       $$(invoke(&Strategy::on_transaction, event->data<Transaction>(), get_location(event->source())));
-  events_ | is(Order::tag) | $$(invoke(&Strategy::on_order, event->data<Order>(), get_location(event->source())));
-  events_ | is(Trade::tag) | $$(invoke(&Strategy::on_trade, event->data<Trade>(), get_location(event->source())));
+  route(Order::tag, [&](const event_ptr &event) {
+    invoke(&Strategy::on_order, event->data<Order>(), get_location(event->source()));
+  });
+  route(Trade::tag, [&](const event_ptr &event) {
+    invoke(&Strategy::on_trade, event->data<Trade>(), get_location(event->source()));
+  });
   events_ | is_custom() |
       $$(invoke(&Strategy::on_custom_data, event->msg_type(),
                 {event->data_as_bytes(), event->data_as_bytes() + event->data_length()}, event->data_length(),
                 get_location(event->source())));
-  events_ | is(HistoryOrder::tag) |
-      $$(invoke(&Strategy::on_history_order, event->data<HistoryOrder>(), get_location(event->source())));
-  events_ | is(HistoryTrade::tag) |
-      $$(invoke(&Strategy::on_history_trade, event->data<HistoryTrade>(), get_location(event->source())));
-  events_ | is(RequestHistoryOrderError::tag) |
-      $$(invoke(&Strategy::on_req_history_order_error, event->data<RequestHistoryOrderError>(),
-                get_location(event->source())));
-  events_ | is(RequestHistoryTradeError::tag) |
-      $$(invoke(&Strategy::on_req_history_trade_error, event->data<RequestHistoryTradeError>(),
-                get_location(event->source())));
-  events_ | is(OrderActionError::tag) |
-      $$(invoke(&Strategy::on_order_action_error, event->data<OrderActionError>(), get_location(event->source())));
+  route(HistoryOrder::tag, [&](const event_ptr &event) {
+    invoke(&Strategy::on_history_order, event->data<HistoryOrder>(), get_location(event->source()));
+  });
+  route(HistoryTrade::tag, [&](const event_ptr &event) {
+    invoke(&Strategy::on_history_trade, event->data<HistoryTrade>(), get_location(event->source()));
+  });
+  route(RequestHistoryOrderError::tag, [&](const event_ptr &event) {
+    invoke(&Strategy::on_req_history_order_error, event->data<RequestHistoryOrderError>(),
+           get_location(event->source()));
+  });
+  route(RequestHistoryTradeError::tag, [&](const event_ptr &event) {
+    invoke(&Strategy::on_req_history_trade_error, event->data<RequestHistoryTradeError>(),
+           get_location(event->source()));
+  });
+  route(OrderActionError::tag, [&](const event_ptr &event) {
+    invoke(&Strategy::on_order_action_error, event->data<OrderActionError>(), get_location(event->source()));
+  });
   events_ | is_own<Deregister>(context_->get_broker_client()) |
       $$(invoke(&Strategy::on_deregister, event->data<Deregister>(), get_location(event->source())));
   events_ | is_own<BrokerStateUpdate>(context_->get_broker_client()) |
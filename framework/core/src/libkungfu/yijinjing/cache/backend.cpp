@@ -7,9 +7,45 @@
 #include <kungfu/yijinjing/cache/backend.h>
 
 namespace kungfu::yijinjing::cache {
+using SnapshotTypes = std::array<bool, longfist::msg_type_ordinal::COUNT + 1>;
+
+static SnapshotTypes make_snapshot_types(const std::vector<std::string> &type_names) {
+  auto listed = [&](const std::string &name) {
+    return std::find(type_names.begin(), type_names.end(), name) != type_names.end();
+  };
+  SnapshotTypes types = {};
+  boost::hana::for_each(longfist::StateDataTypes, [&](auto it) {
+    using DataType = typename decltype(+boost::hana::second(it))::type;
+    auto name = std::string(boost::hana::first(it).c_str());
+    types[longfist::msg_type_ordinal::of(DataType::tag)] = size_fixed_v<DataType> and (listed(name) or listed("all"));
+  });
+  return types;
+}
+
+static std::vector<std::string> get_env_snapshot_types() {
+  char *env = std::getenv("KF_CACHE_SNAPSHOT_TYPES");
+  std::vector<std::string> type_names = {};
+  std::stringstream ss(env == nullptr ? "" : env);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    type_names.push_back(name);
+  }
+  return type_names;
+}
+
+static SnapshotTypes snapshot_types = make_snapshot_types(get_env_snapshot_types());
+
+void shift::set_snapshot_types(const std::vector<std::string> &type_names) {
+  snapshot_types = make_snapshot_types(type_names);
+}
+
+bool shift::is_snapshot_type(int32_t msg_type) { return snapshot_types[longfist::msg_type_ordinal::of(msg_type)]; }
+
 shift::shift(yijinjing::data::location_ptr location) : location_(std::move(location)), storage_map_() {}
 
-shift::shift(const shift &copy) : location_(copy.location_), storage_map_(copy.storage_map_) {}
+shift::shift(const shift &copy)
+    : location_(copy.location_), storage_map_(copy.storage_map_), statements_(copy.statements_),
+      snapshots_(copy.snapshots_) {}
 
 void shift::ensure_storage(uint32_t dest) {
   if (storage_map_.find(dest) != storage_map_.end()) {
@@ -22,4 +58,25 @@ void shift::ensure_storage(uint32_t dest) {
   storage->sync_schema();
   storage_map_.emplace(dest, storage);
 }
+
+void shift::begin_batch() { batching_ = true; }
+
+void shift::commit_batch() {
+  batching_ = false;
+  auto transactions = std::move(transactions_);
+  transactions_ = {};
+  for (auto it = transactions.begin(); it != transactions.end(); it++) {
+    try {
+      storage_map_.at(*it)->commit();
+    } catch (const std::exception &ex) {
+      for (; it != transactions.end(); it++) {
+        try {
+          storage_map_.at(*it)->rollback();
+        } catch (const std::exception &) {
+        }
+      }
+      throw;
+    }
+  }
+}
 } // namespace kungfu::yijinjing::cache
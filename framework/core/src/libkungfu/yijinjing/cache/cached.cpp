@@ -16,13 +16,19 @@ using namespace kungfu::yijinjing::cache;
 
 #define DEFAULT_STORE_VOLUME_BY_INTERVAL 100
 #define LOW_LATENCY_STORE_VOLUME_BY_INTERVAL 10
+#define DEFAULT_MAX_STORE_VOLUME_BY_INTERVAL 10000
+#define LOW_LATENCY_MAX_STORE_VOLUME_BY_INTERVAL 1000
+// each loop stores this fraction of pending states, within the volume bounds above
+#define STORE_BACKLOG_FRACTION 4
 
 namespace kungfu::yijinjing::cache {
 
 cached::cached(locator_ptr locator, mode m, bool low_latency)
     : apprentice(location::make_shared(m, category::SYSTEM, "service", "cached", std::move(locator)), low_latency),
       profile_(get_locator()),
-      store_volume_every_loop_(low_latency ? LOW_LATENCY_STORE_VOLUME_BY_INTERVAL : DEFAULT_STORE_VOLUME_BY_INTERVAL) {
+      store_volume_every_loop_(low_latency ? LOW_LATENCY_STORE_VOLUME_BY_INTERVAL : DEFAULT_STORE_VOLUME_BY_INTERVAL),
+      max_store_volume_every_loop_(low_latency ? LOW_LATENCY_MAX_STORE_VOLUME_BY_INTERVAL
+                                               : DEFAULT_MAX_STORE_VOLUME_BY_INTERVAL) {
   profile_.setup();
   profile_get_all(profile_, profile_bank_);
 }
@@ -74,13 +80,13 @@ void cached::on_frame() {}
 
 void cached::on_active() {
   SPDLOG_TRACE("cached::on_active");
-  handle_cached_feeds(store_volume_every_loop_);
+  handle_cached_feeds(store_volume_every_loop_, max_store_volume_every_loop_);
   handle_profile_feeds(store_volume_every_loop_);
 }
 
 void cached::on_notify() {
   SPDLOG_TRACE("cached::on_notify");
-  handle_cached_feeds(LOW_LATENCY_STORE_VOLUME_BY_INTERVAL);
+  handle_cached_feeds(LOW_LATENCY_STORE_VOLUME_BY_INTERVAL, LOW_LATENCY_MAX_STORE_VOLUME_BY_INTERVAL);
 }
 
 void cached::mark_request_cached_done(uint32_t dest_id) {
@@ -90,8 +96,26 @@ void cached::mark_request_cached_done(uint32_t dest_id) {
   writer->close_data();
 }
 
-void cached::handle_cached_feeds(int store_volume_every_loop) {
-  int stored_controller = 0;
+void cached::handle_cached_feeds(size_t min_store_volume, size_t max_store_volume) {
+  size_t backlog = 0;
+  boost::hana::for_each(StateDataTypes, [&](auto it) {
+    using DataType = typename decltype(+boost::hana::second(it))::type;
+    backlog += feed_bank_[boost::hana::type_c<DataType>].size();
+  });
+  boost::hana::for_each(TradingDataTypes, [&](auto it) {
+    using DataType = typename decltype(+boost::hana::second(it))::type;
+    backlog += trading_bank_[boost::hana::type_c<DataType>].size();
+  });
+  if (backlog == 0) {
+    return;
+  }
+  auto store_volume = std::clamp(backlog / STORE_BACKLOG_FRACTION, min_store_volume, max_store_volume);
+
+  for (auto &pair : app_cache_shift_) {
+    pair.second.begin_batch();
+  }
+  stored_feeds_.clear();
+  // left over trading states are older than those in rings, they go first
   boost::hana::for_each(StateDataTypes, [&](auto it) {
     using DataType = typename decltype(+boost::hana::second(it))::type;
     auto hana_type = boost::hana::type_c<DataType>;
@@ -99,31 +123,101 @@ void cached::handle_cached_feeds(int store_volume_every_loop) {
     using FeedMap = std::unordered_map<uint64_t, state<DataType>>;
     auto &feed_map = const_cast<FeedMap &>(feed_bank_[hana_type]);
 
-    if (feed_map.size() != 0) {
-      auto iter = feed_map.begin();
-      while (iter != feed_map.end() and stored_controller <= store_volume_every_loop) {
-        auto &s = iter->second;
-        auto source_id = s.source;
-        auto dest_id = s.dest;
-        if (app_cache_shift_.find(source_id) != app_cache_shift_.end()) {
-          try {
-            app_cache_shift_.at(source_id) << s;
-            SPDLOG_TRACE("cache [feed] source {} dest {} {} data {}", get_location_uname(source_id),
-                         get_location_uname(dest_id), DataType::type_name.c_str(), s.data.to_string());
-          } catch (const std::exception &e) {
-            SPDLOG_ERROR("Unexpected exception by handle_cached_feeds {}", e.what());
-            stored_controller++;
-            break;
-          }
-
-          iter = feed_map.erase(iter);
-          stored_controller++;
-        } else {
-          iter++;
-        }
+    for (auto iter = feed_map.begin(); iter != feed_map.end() and stored_feeds_.size() < store_volume; iter++) {
+      auto &s = iter->second;
+      auto source_id = s.source;
+      auto dest_id = s.dest;
+      auto shift_iter = app_cache_shift_.find(source_id);
+      if (shift_iter == app_cache_shift_.end()) {
+        continue;
+      }
+      try {
+        shift_iter->second << s;
+        SPDLOG_TRACE("cache [feed] source {} dest {} {} data {}", get_location_uname(source_id),
+                     get_location_uname(dest_id), DataType::type_name.c_str(), s.data.to_string());
+      } catch (const std::exception &e) {
+        SPDLOG_ERROR("Unexpected exception by handle_cached_feeds {}", e.what());
+        break;
       }
+      stored_feeds_.push_back({DataType::tag, source_id, iter->first});
     }
   });
+  auto stored_volumes = store_trading_feeds(store_volume - std::min(store_volume, stored_feeds_.size()));
+
+  // states are dropped from feed bank only if committed, otherwise they get stored again by next batch
+  std::unordered_set<uint32_t> failed_sources = {};
+  for (auto &pair : app_cache_shift_) {
+    try {
+      pair.second.commit_batch();
+    } catch (const std::exception &e) {
+      SPDLOG_ERROR("failed to commit cache {} {}", get_location_uname(pair.first), e.what());
+      failed_sources.insert(pair.first);
+    }
+  }
+  for (const auto &stored : stored_feeds_) {
+    if (failed_sources.find(stored.source) != failed_sources.end()) {
+      continue;
+    }
+    longfist::dispatch(StateDataTypes, stored.msg_type, [&](auto type) {
+      using DataType = typename decltype(type)::type;
+      using FeedMap = std::unordered_map<uint64_t, state<DataType>>;
+      const_cast<FeedMap &>(feed_bank_[type]).erase(stored.uid);
+    });
+  }
+  settle_trading_feeds(stored_volumes, failed_sources);
+}
+
+std::vector<size_t> cached::store_trading_feeds(size_t store_volume) {
+  std::vector<size_t> stored_volumes = {};
+  boost::hana::for_each(TradingDataTypes, [&](auto it) {
+    using DataType = typename decltype(+boost::hana::second(it))::type;
+    using FeedMap = std::unordered_map<uint64_t, state<DataType>>;
+    auto hana_type = boost::hana::type_c<DataType>;
+    auto &ring = trading_bank_[hana_type];
+    auto &feed_map = const_cast<FeedMap &>(feed_bank_[hana_type]);
+
+    auto volume = std::min(ring.available(), store_volume);
+    for (size_t i = 0; i < volume; i++) {
+      auto &s = ring.at(i);
+      auto shift_iter = app_cache_shift_.find(s.source);
+      if (shift_iter == app_cache_shift_.end()) {
+        continue;
+      }
+      try {
+        shift_iter->second << s;
+        SPDLOG_TRACE("cache [trading] source {} dest {} {} data {}", get_location_uname(s.source),
+                     get_location_uname(s.dest), DataType::type_name.c_str(), s.data.to_string());
+      } catch (const std::exception &e) {
+        SPDLOG_ERROR("Unexpected exception by store_trading_feeds {}", e.what());
+        volume = i;
+        break;
+      }
+      // newer than any left over state of the same uid
+      if (not feed_map.empty()) {
+        feed_map.erase(s.data.uid());
+      }
+    }
+    store_volume -= volume;
+    stored_volumes.push_back(volume);
+  });
+  return stored_volumes;
+}
+
+void cached::settle_trading_feeds(const std::vector<size_t> &stored_volumes,
+                                  const std::unordered_set<uint32_t> &failed) {
+  size_t index = 0;
+  boost::hana::for_each(TradingDataTypes, [&](auto it) {
+    using DataType = typename decltype(+boost::hana::second(it))::type;
+    auto &ring = trading_bank_[boost::hana::type_c<DataType>];
+    auto volume = stored_volumes.at(index++);
+    for (size_t i = 0; i < volume; i++) {
+      auto &s = ring.at(i);
+      if (failed.find(s.source) != failed.end() or app_cache_shift_.find(s.source) == app_cache_shift_.end()) {
+        feed_bank_ << s;
+      }
+    }
+    ring.pop(volume);
+  });
 }
 
 void cached::handle_profile_feeds(int store_volume_every_loop) {
@@ -228,8 +322,34 @@ void cached::feed(const event_ptr &event) {
   if (event->msg_type() != Instrument::tag and get_location(event->source())->category == category::MD) {
     return;
   }
-  feed_state_data(event, feed_bank_);
+  feed_trading(event);
   feed_profile_data(event, profile_bank_);
 }
 
+void cached::feed_trading(const event_ptr &event) {
+  bool is_trading = longfist::dispatch(TradingDataTypes, event->msg_type(), [&](auto type) {
+    using DataType = typename decltype(type)::type;
+    if (trading_bank_ << typed_event_ptr<DataType>(event)) {
+      return;
+    }
+    // ring is full, store everything pending to make room, states are never dropped
+    SPDLOG_DEBUG("trading bank full for {}, store pending states now", DataType::type_name.c_str());
+    handle_cached_feeds(SIZE_MAX, SIZE_MAX);
+    if (trading_bank_ << typed_event_ptr<DataType>(event)) {
+      return;
+    }
+    // still full as storing failed, pending states go to feed bank ahead of this one so the newest of each uid wins
+    auto &ring = trading_bank_[type];
+    auto pending = ring.available();
+    for (size_t i = 0; i < pending; i++) {
+      feed_bank_ << ring.at(i);
+    }
+    ring.pop(pending);
+    trading_bank_ << typed_event_ptr<DataType>(event);
+  });
+  if (not is_trading) {
+    feed_state_data(event, feed_bank_);
+  }
+}
+
 } // namespace kungfu::yijinjing::cache
\ No newline at end of file
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+
+#include <kungfu/yijinjing/cache/snapshot.h>
+#include <kungfu/yijinjing/time.h>
+#include <kungfu/yijinjing/util/os.h>
+
+namespace kungfu::yijinjing::cache {
+
+constexpr char SNAPSHOT_MAGIC[8] = "KFSNAP1";
+
+constexpr size_t SNAPSHOT_INITIAL_SIZE = 64 * KB;
+
+constexpr int64_t SNAPSHOT_COMPACTION_INTERVAL = 60 * time_unit::NANOSECONDS_PER_SECOND;
+
+/** records are aligned to 8 bytes */
+static size_t get_record_size(uint32_t data_size) { return (sizeof(snapshot_record) + data_size + 7u) & ~size_t(7u); }
+
+snapshot::snapshot(std::string path, int32_t msg_type, uint32_t data_size, bool is_writing)
+    : path_(std::move(path)), msg_type_(msg_type), data_size_(data_size), record_size_(get_record_size(data_size)),
+      is_writing_(is_writing), next_compaction_time_(time::now_in_nano() + SNAPSHOT_COMPACTION_INTERVAL) {
+  std::error_code ec;
+  size_t file_size = std::filesystem::exists(path_, ec) ? std::filesystem::file_size(path_, ec) : 0;
+  if (is_writing_) {
+    map(path_, std::max(file_size, SNAPSHOT_INITIAL_SIZE + record_size_));
+  } else if (file_size > sizeof(snapshot_header)) {
+    map(path_, file_size);
+  }
+  load();
+}
+
+snapshot::~snapshot() { unmap(); }
+
+void snapshot::put(uint64_t uid, const void *data) {
+  assert(is_writing_);
+  auto count = header()->record_count.load(std::memory_order_relaxed);
+  bool full = count >= record_capacity();
+  if (full or time::now_in_nano() >= next_compaction_time_) {
+    next_compaction_time_ = time::now_in_nano() + SNAPSHOT_COMPACTION_INTERVAL;
+    auto live_count = index_.size();
+    if (count > live_count and count - live_count >= live_count) {
+      compact();
+      count = header()->record_count.load(std::memory_order_relaxed);
+    }
+  }
+  if (count >= record_capacity()) {
+    auto size = mapped_size_ * 2;
+    unmap();
+    map(path_, size);
+  }
+  auto record = reinterpret_cast<snapshot_record *>(record_address(count));
+  record->uid = uid;
+  record->reserved = 0;
+  memcpy(reinterpret_cast<void *>(record_address(count) + sizeof(snapshot_record)), data, data_size_);
+  header()->record_count.store(count + 1, std::memory_order_release); // record counts once it is in place
+  index_.insert_or_assign(uid, count);
+}
+
+void snapshot::clear() {
+  assert(is_writing_);
+  header()->record_count.store(0, std::memory_order_release);
+  index_.clear();
+}
+
+void snapshot::compact() {
+  // live records go to a new file that replaces the current one at once, a crash in between leaves the current intact
+  auto compact_path = path_ + ".compact";
+  std::error_code ec;
+  std::filesystem::remove(compact_path, ec);
+  auto size = mapped_size_;
+  auto address = os::load_mmap_buffer(compact_path, size, true, true);
+  auto compact_header = reinterpret_cast<snapshot_header *>(address);
+  memcpy(compact_header->magic, SNAPSHOT_MAGIC, sizeof(compact_header->magic));
+  compact_header->msg_type = msg_type_;
+  compact_header->data_size = data_size_;
+
+  std::unordered_map<uint64_t, uint64_t> index = {};
+  index.reserve(index_.size());
+  uint64_t compact_count = 0;
+  auto count = record_count();
+  for (uint64_t n = 0; n < count; n++) {
+    auto record = reinterpret_cast<const snapshot_record *>(record_address(n));
+    auto it = index_.find(record->uid);
+    if (it != index_.end() and it->second == n) {
+      auto target = address + sizeof(snapshot_header) + compact_count * record_size_;
+      memcpy(reinterpret_cast<void *>(target), record, record_size_);
+      index.emplace(record->uid, compact_count++);
+    }
+  }
+  compact_header->record_count.store(compact_count, std::memory_order_release);
+  os::release_mmap_buffer(address, size, true);
+
+  // replacing a mapped file fails on windows, on failure the current file is mapped again and stays in use
+  unmap();
+  std::filesystem::rename(compact_path, path_, ec);
+  map(path_, size);
+  if (ec) {
+    SPDLOG_WARN("failed to compact snapshot {}, {}", path_, ec.message());
+    std::filesystem::remove(compact_path, ec);
+    return;
+  }
+  index_ = std::move(index);
+  SPDLOG_DEBUG("compacted snapshot {} from {} to {} records", path_, count, compact_count);
+}
+
+std::string snapshot::get_path(const data::location_ptr &location, uint32_t dest_id, const std::string &type_name) {
+  auto dir = std::filesystem::path(location->locator->layout_dir(location, longfist::enums::layout::SQLITE));
+  return (dir / fmt::format("{:08x}.{}.snapshot", dest_id, type_name)).string();
+}
+
+void snapshot::map(const std::string &path, size_t size) {
+  address_ = os::load_mmap_buffer(path, size, is_writing_, true);
+  mapped_size_ = size;
+}
+
+void snapshot::unmap() {
+  if (address_ != 0) {
+    os::release_mmap_buffer(address_, mapped_size_, true);
+    address_ = 0;
+    mapped_size_ = 0;
+  }
+}
+
+void snapshot::reset() {
+  auto h = header();
+  memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+  h->msg_type = msg_type_;
+  h->data_size = data_size_;
+  h->record_count.store(0, std::memory_order_release);
+  memset(h->reserved, 0, sizeof(h->reserved));
+  index_.clear();
+}
+
+void snapshot::load() {
+  index_.clear();
+  if (address_ == 0) {
+    return;
+  }
+  auto h = header();
+  bool valid = memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) == 0 and h->msg_type == msg_type_ and
+               h->data_size == data_size_;
+  if (is_writing_ and (not valid or h->record_count > record_capacity())) {
+    if (h->magic[0] != 0) {
+      SPDLOG_WARN("snapshot {} does not match data layout, start over", path_);
+    }
+    reset();
+    return;
+  }
+  if (not valid) {
+    if (h->magic[0] != 0) {
+      SPDLOG_WARN("snapshot {} does not match data layout, skipped", path_);
+    }
+    unmap();
+    return;
+  }
+  auto count = record_count();
+  for (uint64_t n = 0; n < count; n++) {
+    index_.insert_or_assign(reinterpret_cast<const snapshot_record *>(record_address(n))->uid, n);
+  }
+}
+} // namespace kungfu::yijinjing::cache
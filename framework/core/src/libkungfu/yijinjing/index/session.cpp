@@ -4,7 +4,12 @@
 // Created by Keren Dong on 2020/3/27.
 //
 
+#include <atomic>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #include <kungfu/yijinjing/index/session.h>
 
 using namespace sqlite_orm;
@@ -17,6 +22,18 @@ using namespace kungfu::yijinjing::data;
 using namespace kungfu::yijinjing::journal;
 
 namespace kungfu::yijinjing::index {
+namespace {
+uint64_t journal_key(uint32_t location_uid, uint32_t dest_id) { return uint64_t(location_uid) << 32u | dest_id; }
+
+/**
+ * journals named after the location open, close and count its sessions, master is named as is
+ */
+std::string get_session_journal_name(const Session &session) {
+  bool is_master = session.category == category::SYSTEM and session.group == "master";
+  return is_master ? session.name : fmt::format("{:08x}", session.location_uid);
+}
+} // namespace
+
 std::string get_index_db_file(const io_device_ptr &io_device) {
   auto locator = io_device->get_locator();
   auto index_location = location::make_shared(mode::LIVE, category::SYSTEM, "journal", "index", locator);
@@ -78,7 +95,16 @@ Session &session_builder::open_session(const location_ptr &source_location, int6
   session.begin_time = time;
   session.end_time = 0;
   session.update_time = time;
-  session_storage_->replace(session);
+  session.frame_count = 0;
+  session.data_size = 0;
+  advance_checkpoints(session, time);
+  session_storage_->transaction([&] {
+    session_storage_->replace(session);
+    for (const auto &pair : checkpoints_) {
+      session_storage_->replace(pair.second);
+    }
+    return true;
+  });
   return session;
 }
 
@@ -107,61 +133,311 @@ void session_builder::update_session(const frame_ptr &frame) {
   if (live_sessions_.find(frame->source()) == live_sessions_.end()) {
     return;
   }
+  // frame is not counted yet, checkpoint at its time covers exactly the frames before it
+  if (frame->gen_time() >= next_checkpoint_time_) {
+    checkpoint(frame->gen_time());
+  }
   Session &session = live_sessions_.at(frame->source());
   session.update_time = frame->gen_time();
   session.frame_count++;
   session.data_size += frame->frame_length();
 }
 
-[[maybe_unused]] void session_builder::rebuild_index_db() {
-  std::unordered_map<std::string, location_ptr> formatstr_to_locations = {};
+void session_builder::checkpoint(int64_t time) {
+  for (const auto &pair : live_sessions_) {
+    if (pair.second.end_time == 0) {
+      advance_checkpoints(pair.second, time);
+    }
+  }
+  session_storage_->transaction([&] {
+    for (const auto &pair : live_sessions_) {
+      session_storage_->replace(pair.second);
+    }
+    for (const auto &pair : checkpoints_) {
+      session_storage_->replace(pair.second);
+    }
+    return true;
+  });
+  next_checkpoint_time_ = time + SESSION_CHECKPOINT_INTERVAL;
+}
+
+void session_builder::advance_checkpoints(const Session &session, int64_t time) {
   auto locator = io_device_->get_locator();
-  auto reader = io_device_->open_reader_to_subscribe();
-  for (const auto &location : locator->list_locations("*", "*", "*", "*")) {
-    SPDLOG_TRACE("investigating journal for [{:08x}] {}", location->uid, location->uname);
+  for (const auto &location : locator->list_locations("*", "*", get_session_journal_name(session), "*")) {
+    for (const auto dest_id : locator->list_location_dest(location)) {
+      auto &position = checkpoints_[journal_key(location->uid, dest_id)];
+      position.location_uid = location->uid;
+      position.dest_id = dest_id;
+      position.read_time = time;
+      position.read_count = 0;
+    }
+  }
+}
 
+void session_builder::load_checkpoints() {
+  checkpoints_.clear();
+  for (const auto &checkpoint : session_storage_->get_all<SessionCheckpoint>()) {
+    checkpoints_.emplace(uint64_t(checkpoint.location_uid) << 32u | checkpoint.dest_id, checkpoint);
+  }
+  if (checkpoints_.empty()) {
+    session_storage_->remove_all<Session>();
+    live_sessions_.clear();
+    return;
+  }
+  auto bt = &Session::begin_time;
+  for (const auto &session : session_storage_->get_all<Session>(where(eq(&Session::end_time, 0)), order_by(bt))) {
+    live_sessions_.insert_or_assign(session.location_uid, session);
+  }
+  SPDLOG_INFO("resume index from {} checkpoints, {} open sessions", checkpoints_.size(), live_sessions_.size());
+}
+
+namespace {
+/**
+ * journals sharing one name, only their frames open and close sessions of the location they are named after,
+ * so that partitions can be indexed independently
+ */
+struct index_partition {
+  location_ptr session_location;
+  std::vector<std::pair<location_ptr, uint32_t>> journals = {};
+};
+
+/**
+ * indexes one partition on a worker thread, sessions are kept in memory and written to index db only at checkpoints,
+ * together with read position of the journals: frames before read time, and the first read count frames at read time
+ * are counted
+ */
+class partition_indexer {
+public:
+  partition_indexer(SessionStoragePtr &storage, std::mutex &storage_mutex, index_partition &partition)
+      : storage_(storage), storage_mutex_(storage_mutex), partition_(partition) {}
+
+  SessionMap &sessions() { return sessions_; }
+
+  std::unordered_map<uint64_t, SessionCheckpoint> &checkpoints() { return checkpoints_; }
+
+  void run(const io_device_ptr &io_device) {
+    auto reader = io_device->open_reader_to_subscribe();
+    // journals resume right before read time, frames at read time already counted are skipped one by one
+    std::unordered_map<uint64_t, uint32_t> counted = {};
+    for (const auto &journal : partition_.journals) {
+      auto key = journal_key(journal.first->uid, journal.second);
+      auto position = checkpoints_.find(key);
+      if (position == checkpoints_.end()) {
+        reader->join(journal.first, journal.second, 0);
+        continue;
+      }
+      reader->join(journal.first, journal.second, position->second.read_time - 1);
+      counted.emplace(key, position->second.read_count);
+    }
+    int64_t last_time = 0;
+    while (reader->data_available()) {
+      auto &page = reader->current_page();
+      auto location = page->get_location();
+      auto frame = reader->current_frame();
+      auto key = journal_key(location->uid, page->get_dest_id());
+      auto &position = checkpoints_[key];
+
+      auto skip = counted.find(key);
+      if (skip != counted.end()) {
+        if (frame->gen_time() == position.read_time and skip->second > 0) {
+          skip->second--;
+          reader->next();
+          continue;
+        }
+        counted.erase(skip);
+      }
+      last_time = std::max(last_time, frame->gen_time());
+
+      // frame counts as read before it is handled, update may checkpoint right after counting it
+      position.location_uid = location->uid;
+      position.dest_id = page->get_dest_id();
+      position.read_count = frame->gen_time() == position.read_time ? position.read_count + 1 : 1;
+      position.read_time = frame->gen_time();
+
+      try {
+        if (frame->msg_type() == SessionStart::tag) {
+          open(frame->gen_time());
+        } else if (frame->msg_type() == SessionEnd::tag) {
+          close(frame->gen_time());
+        } else if (location->category != category::SYSTEM or location->group != "master" or
+                   location->name == "master") {
+          update(frame);
+        }
+      } catch (const std::exception &ex) {
+        SPDLOG_ERROR("problematic frame at {}, {}, {}", location->uname, partition_.session_location->uname,
+                     ex.what());
+      }
+      reader->next();
+    }
+    checkpoint(last_time);
+  }
+
+private:
+  SessionStoragePtr &storage_;
+  std::mutex &storage_mutex_;
+  index_partition &partition_;
+  SessionMap sessions_ = {};
+  std::unordered_map<uint64_t, SessionCheckpoint> checkpoints_ = {};
+  /** sessions opened or closed since last checkpoint, in order */
+  std::vector<Session> rows_ = {};
+  int64_t next_checkpoint_time_ = 0;
+
+  void open(int64_t time) {
+    auto &location = partition_.session_location;
+    auto pair = sessions_.try_emplace(location->uid);
+    auto &session = pair.first->second;
+    if (pair.second) {
+      session.location_uid = location->uid;
+      session.category = location->category;
+      session.group = location->group;
+      session.name = location->name;
+      session.mode = location->mode;
+    }
+    session.begin_time = time;
+    session.end_time = 0;
+    session.update_time = time;
+    session.frame_count = 0;
+    session.data_size = 0;
+    rows_.push_back(session);
+  }
+
+  void close(int64_t time) {
+    auto it = sessions_.find(partition_.session_location->uid);
+    if (it == sessions_.end()) {
+      return;
+    }
+    it->second.end_time = time;
+    it->second.update_time = time;
+    rows_.push_back(it->second);
+  }
+
+  void update(const frame_ptr &frame) {
+    auto it = sessions_.find(frame->source());
+    if (it == sessions_.end()) {
+      return;
+    }
+    it->second.update_time = frame->gen_time();
+    it->second.frame_count++;
+    it->second.data_size += frame->frame_length();
+    if (frame->gen_time() >= next_checkpoint_time_) {
+      checkpoint(frame->gen_time());
+    }
+  }
+
+  void checkpoint(int64_t time) {
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    storage_->transaction([&] {
+      for (const auto &session : rows_) {
+        storage_->replace(session);
+      }
+      for (const auto &pair : sessions_) {
+        storage_->replace(pair.second);
+      }
+      for (const auto &pair : checkpoints_) {
+        storage_->replace(pair.second);
+      }
+      return true;
+    });
+    rows_.clear();
+    next_checkpoint_time_ = time + SESSION_CHECKPOINT_INTERVAL;
+  }
+};
+} // namespace
+
+[[maybe_unused]] void session_builder::rebuild_index_db(bool full) {
+  std::unordered_map<std::string, location_ptr> formatstr_to_locations = {};
+  auto locator = io_device_->get_locator();
+  auto locations = locator->list_locations("*", "*", "*", "*");
+  for (const auto &location : locations) {
     if (location->category != category::SYSTEM or location->group != "master") {
       formatstr_to_locations.emplace(fmt::format("{:08x}", location->uid), location);
     }
-
     if (location->category == category::SYSTEM and location->group == "master" and location->name == "master") {
       formatstr_to_locations.emplace(location->name, location);
     }
+  }
 
+  // journals named after no location never touch sessions, they are left out
+  std::map<std::string, index_partition> partition_map = {};
+  for (const auto &location : locations) {
+    SPDLOG_TRACE("investigating journal for [{:08x}] {}", location->uid, location->uname);
+    auto session_location = formatstr_to_locations.find(location->name);
+    if (session_location == formatstr_to_locations.end()) {
+      continue;
+    }
+    auto &partition = partition_map[location->name];
+    partition.session_location = session_location->second;
     for (const auto dest_uid : locator->list_location_dest(location)) {
-      reader->join(location, dest_uid, 0);
+      partition.journals.emplace_back(location, dest_uid);
     }
   }
 
-  session_storage_->remove_all<Session>();
-  while (reader->data_available()) {
-    auto location = reader->current_page()->get_location();
-    std::string uid_str = location->name;
-    auto frame = reader->current_frame();
-    if (formatstr_to_locations.find(uid_str) == formatstr_to_locations.end()) {
-      reader->next();
-      continue;
+  if (full) {
+    session_storage_->remove_all<SessionCheckpoint>();
+  }
+  load_checkpoints();
+  std::mutex storage_mutex;
+  std::vector<index_partition> partitions = {};
+  std::vector<partition_indexer> indexers = {};
+  for (auto &pair : partition_map) {
+    partitions.push_back(std::move(pair.second));
+  }
+  // larger partitions first, so that they do not end up last on a single thread
+  std::sort(partitions.begin(), partitions.end(),
+            [](const auto &a, const auto &b) { return a.journals.size() > b.journals.size(); });
+  indexers.reserve(partitions.size());
+  for (auto &partition : partitions) {
+    auto &indexer = indexers.emplace_back(session_storage_, storage_mutex, partition);
+    auto session = live_sessions_.find(partition.session_location->uid);
+    if (session != live_sessions_.end() and session->second.end_time == 0) {
+      indexer.sessions().insert_or_assign(session->first, session->second);
     }
+    for (const auto &journal : partition.journals) {
+      auto key = journal_key(journal.first->uid, journal.second);
+      auto position = checkpoints_.find(key);
+      if (position != checkpoints_.end()) {
+        indexer.checkpoints().insert_or_assign(key, position->second);
+      }
+    }
+  }
 
+  std::atomic<size_t> next_partition = 0;
+  std::atomic<bool> failed = false;
+  std::exception_ptr error = nullptr;
+  std::mutex error_mutex;
+  auto index = [&]() {
     try {
-      if (frame->msg_type() == SessionStart::tag) {
-        open_session(formatstr_to_locations.at(uid_str), frame->gen_time());
-      } else if (frame->msg_type() == SessionEnd::tag) {
-        close_session(formatstr_to_locations.at(uid_str), frame->gen_time());
-      } else if (location->category != category::SYSTEM or location->group != "master") {
-        update_session(frame);
-      } else if (location->category == category::SYSTEM and location->group == "master" and
-                 location->name == "master") {
-        update_session(frame);
+      for (size_t i = next_partition++; i < indexers.size() and not failed; i = next_partition++) {
+        indexers[i].run(io_device_);
       }
-    } catch (const std::exception &ex) {
-      SPDLOG_ERROR("problematic frame at {}, {}, {}", location->uname, formatstr_to_locations.at(uid_str)->uname,
-                   ex.what());
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      error = error == nullptr ? std::current_exception() : error;
+      failed = true;
     }
-    reader->next();
+  };
+  auto thread_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), indexers.size());
+  std::vector<std::thread> threads = {};
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(index);
   }
-  for (const auto &pair : live_sessions_) {
-    session_storage_->replace(pair.second);
+  index();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+
+  for (auto &indexer : indexers) {
+    for (auto &pair : indexer.sessions()) {
+      live_sessions_.insert_or_assign(pair.first, pair.second);
+    }
+    for (auto &pair : indexer.checkpoints()) {
+      checkpoints_.insert_or_assign(pair.first, pair.second);
+    }
   }
+  SPDLOG_INFO("indexed {} journals of {} locations on {} threads", checkpoints_.size(), partitions.size(),
+              std::max<size_t>(thread_count, 1));
 }
 } // namespace kungfu::yijinjing::index
\ No newline at end of file
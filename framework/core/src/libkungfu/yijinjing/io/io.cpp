@@ -1,13 +1,25 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <climits>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+
 #include <kungfu/common.h>
 #include <kungfu/yijinjing/io.h>
 #include <kungfu/yijinjing/log.h>
 #include <kungfu/yijinjing/time.h>
+#include <kungfu/yijinjing/util/os.h>
 
 #define SETUP_TIMEOUT 50
 #define DEFAULT_RECV_TIMEOUT 100
 #define DEFAULT_NOTICE_TIMEOUT 1000
+#define NOTICE_SPIN_NANOSECONDS 50000
+#define NOTICE_POLL_NANOSECONDS 1000000
 
 using namespace kungfu::longfist;
 using namespace kungfu::longfist::enums;
@@ -30,6 +42,106 @@ public:
   }
 };
 
+/**
+ * Wakeup words in shared memory, as a replacement of the "{}" nanomsg message sent for every frame written.
+ * Each channel follows the nanomsg route it replaces: clients wake master, master wakes clients, and master relays
+ * frames of clients by notify on its wakeups, as it does for "{}". Writers bump the sequence of their channel and only
+ * call into kernel when some consumer is parked on it.
+ * Nanomsg is still used to deliver notices, senders also bump the notice count of the channel,
+ * so that receivers know to poll for the message.
+ */
+class futex_notice {
+public:
+  enum channel : int { TO_MASTER, TO_CLIENTS };
+
+  explicit futex_notice(const io_device &io_device)
+      : location_(std::make_shared<data::location>(longfist::enums::mode::LIVE, longfist::enums::category::SYSTEM,
+                                                   "master", "master", io_device.get_home()->locator)),
+        path_(location_->locator->layout_file(location_, layout::NANOMSG, "notice")),
+        words_(reinterpret_cast<words *>(os::load_mmap_buffer(path_, sizeof(words), true, true))) {}
+
+  ~futex_notice() { os::release_mmap_buffer(reinterpret_cast<uintptr_t>(words_), sizeof(words), true); }
+
+  /**
+   * called by master, clients follow the mode master runs with. Words other than enabled are left alone, clients may
+   * be parked on them, they start from zero when the file gets created.
+   */
+  void set_enabled(bool enabled) {
+#ifdef __linux__
+    words_->enabled = enabled;
+#else
+    words_->enabled = false;
+#endif // __linux__
+  }
+
+  [[nodiscard]] bool is_enabled() const { return words_->enabled; }
+
+  [[nodiscard]] uint32_t get_sequence(channel c) const {
+    return words_->channels[c].sequence.load(std::memory_order_acquire);
+  }
+
+  [[nodiscard]] uint32_t get_notices(channel c) const {
+    return words_->channels[c].notices.load(std::memory_order_acquire);
+  }
+
+  void signal(channel c) {
+    auto &word = words_->channels[c];
+    word.sequence.fetch_add(1);
+    if (word.waiters.load() > 0) {
+      // there is only one master to wake
+      futex(word, FUTEX_WAKE, c == TO_MASTER ? 1 : INT_MAX, nullptr);
+    }
+  }
+
+  void signal_notice(channel c) {
+    words_->channels[c].notices.fetch_add(1);
+    signal(c);
+  }
+
+  /**
+   * spin for a while, then sleep until sequence of the channel moves on from the given one, or timeout
+   */
+  void wait(channel c, uint32_t sequence, int64_t timeout) {
+    auto &word = words_->channels[c];
+    int64_t spin_until = time::now_in_nano() + NOTICE_SPIN_NANOSECONDS;
+    while (get_sequence(c) == sequence) {
+      if (time::now_in_nano() > spin_until) {
+        word.waiters.fetch_add(1);
+        struct timespec ts = {timeout / time_unit::NANOSECONDS_PER_SECOND, timeout % time_unit::NANOSECONDS_PER_SECOND};
+        futex(word, FUTEX_WAIT, sequence, &ts);
+        word.waiters.fetch_sub(1);
+        return;
+      }
+    }
+  }
+
+private:
+  /** words of a channel, on its own cache line so that master and clients do not bounce each other's */
+  struct alignas(64) channel_words {
+    std::atomic<uint32_t> waiters;
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> notices;
+  };
+
+  struct words {
+    volatile uint32_t enabled;
+    channel_words channels[2];
+  };
+
+  const location_ptr location_;
+  const std::string path_;
+  words *words_;
+
+  static void futex([[maybe_unused]] channel_words &word, [[maybe_unused]] int op, [[maybe_unused]] uint32_t value,
+                    [[maybe_unused]] const struct timespec *timeout) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word.sequence), op, value, timeout, nullptr, 0);
+#endif // __linux__
+  }
+};
+
+DECLARE_PTR(futex_notice)
+
 class nanomsg_resource : public resource {
 protected:
   nanomsg_resource(const io_device &io_device, bool low_latency, protocol p)
@@ -49,24 +161,42 @@ protected:
 
 class nanomsg_publisher : public publisher, protected nanomsg_resource {
 public:
-  nanomsg_publisher(const io_device &io_device, bool low_latency, protocol p)
-      : nanomsg_resource(io_device, low_latency, p) {}
+  nanomsg_publisher(const io_device &io_device, bool low_latency, protocol p, futex_notice_ptr notice = {},
+                    futex_notice::channel channel = futex_notice::TO_MASTER)
+      : nanomsg_resource(io_device, low_latency, p), notice_(std::move(notice)), channel_(channel) {}
 
   ~nanomsg_publisher() override { socket_.close(); }
 
   void setup() override {}
 
-  int notify() override { return low_latency_ ? 0 : publish("{}"); }
+  int notify() override {
+    if (low_latency_) {
+      return 0;
+    }
+    if (notice_ and notice_->is_enabled()) {
+      notice_->signal(channel_);
+      return 0;
+    }
+    return publish("{}");
+  }
 
   int publish(const std::string &json_message, int flags = NN_DONTWAIT) override {
-    return socket_.send(json_message, flags);
+    auto rc = socket_.send(json_message, flags);
+    if (notice_ and notice_->is_enabled()) {
+      notice_->signal_notice(channel_);
+    }
+    return rc;
   }
+
+private:
+  futex_notice_ptr notice_;
+  futex_notice::channel channel_;
 };
 
 class nanomsg_publisher_master : public nanomsg_publisher {
 public:
-  nanomsg_publisher_master(const io_device &io_device, bool low_latency)
-      : nanomsg_publisher(io_device, low_latency, protocol::PUBLISH) {
+  nanomsg_publisher_master(const io_device &io_device, bool low_latency, futex_notice_ptr notice = {})
+      : nanomsg_publisher(io_device, low_latency, protocol::PUBLISH, std::move(notice), futex_notice::TO_CLIENTS) {
     socket_.bind(bind_path_);
   }
 
@@ -75,8 +205,8 @@ public:
 
 class nanomsg_publisher_client : public nanomsg_publisher {
 public:
-  nanomsg_publisher_client(const io_device &io_device, bool low_latency)
-      : nanomsg_publisher(io_device, low_latency, protocol::PUSH) {
+  nanomsg_publisher_client(const io_device &io_device, bool low_latency, futex_notice_ptr notice = {})
+      : nanomsg_publisher(io_device, low_latency, protocol::PUSH, std::move(notice), futex_notice::TO_MASTER) {
     socket_.connect(connect_path_);
   }
 
@@ -94,8 +224,10 @@ public:
 
 class nanomsg_observer : public observer, protected nanomsg_resource {
 public:
-  nanomsg_observer(const io_device &io_device, bool low_latency, protocol p)
-      : nanomsg_resource(io_device, low_latency, p), recv_flags_(low_latency ? NN_DONTWAIT : 0) {
+  nanomsg_observer(const io_device &io_device, bool low_latency, protocol p, futex_notice_ptr notice = {},
+                   futex_notice::channel channel = futex_notice::TO_MASTER)
+      : nanomsg_resource(io_device, low_latency, p), recv_flags_(low_latency ? NN_DONTWAIT : 0),
+        notice_(std::move(notice)), channel_(channel) {
     socket_.setsockopt_int(NN_SOL_SOCKET, NN_RCVTIMEO, DEFAULT_RECV_TIMEOUT);
   }
 
@@ -105,20 +237,65 @@ public:
     if (not low_latency_) {
       socket_.setsockopt_int(NN_SOL_SOCKET, NN_RCVTIMEO, DEFAULT_NOTICE_TIMEOUT);
     }
+    if (notice_) {
+      last_sequence_ = notice_->get_sequence(channel_);
+      last_notices_ = notice_->get_notices(channel_);
+    }
   }
 
-  bool wait() override { return socket_.recv(recv_flags_) > 0; }
+  /**
+   * in futex mode, wakeups for frames come with notice "{}" as in nanomsg mode, so that master relays them to clients
+   */
+  bool wait() override {
+    frame_wakeup_ = false;
+    if (low_latency_ or not notice_ or not notice_->is_enabled()) {
+      return socket_.recv(recv_flags_) > 0;
+    }
+    if (socket_.recv(NN_DONTWAIT) > 0) {
+      return true;
+    }
+    notice_->wait(channel_, last_sequence_, DEFAULT_NOTICE_TIMEOUT * time_unit::NANOSECONDS_PER_MILLISECOND);
+    auto sequence = notice_->get_sequence(channel_);
+    auto previous_sequence = last_sequence_;
+    frame_wakeup_ = sequence != last_sequence_;
+    last_sequence_ = sequence;
+    auto notices = notice_->get_notices(channel_);
+    if (notices == last_notices_) {
+      return frame_wakeup_;
+    }
+    last_notices_ = notices;
+    // message is sent before notice count bumped, but may still be on its way
+    int64_t poll_until = time::now_in_nano() + NOTICE_POLL_NANOSECONDS;
+    while (time::now_in_nano() < poll_until) {
+      if (socket_.recv(NN_DONTWAIT) > 0) {
+        // message goes first, frame wakeup is left for the next wait
+        last_sequence_ = frame_wakeup_ ? previous_sequence : sequence;
+        frame_wakeup_ = false;
+        return true;
+      }
+      std::this_thread::yield();
+    }
+    return frame_wakeup_;
+  }
 
-  const std::string &get_notice() override { return socket_.last_message(); }
+  const std::string &get_notice() override {
+    static const std::string frame_notice = "{}";
+    return frame_wakeup_ ? frame_notice : socket_.last_message();
+  }
 
 private:
   int recv_flags_;
+  bool frame_wakeup_ = false;
+  futex_notice_ptr notice_;
+  futex_notice::channel channel_;
+  uint32_t last_sequence_ = 0;
+  uint32_t last_notices_ = 0;
 };
 
 class nanomsg_observer_master : public nanomsg_observer {
 public:
-  nanomsg_observer_master(const io_device &io_device, bool low_latency)
-      : nanomsg_observer(io_device, low_latency, protocol::PULL) {
+  nanomsg_observer_master(const io_device &io_device, bool low_latency, futex_notice_ptr notice = {})
+      : nanomsg_observer(io_device, low_latency, protocol::PULL, std::move(notice), futex_notice::TO_MASTER) {
     socket_.bind(bind_path_);
   }
 
@@ -127,8 +304,8 @@ public:
 
 class nanomsg_observer_client : public nanomsg_observer {
 public:
-  nanomsg_observer_client(const io_device &io_device, bool low_latency)
-      : nanomsg_observer(io_device, low_latency, protocol::SUBSCRIBE) {
+  nanomsg_observer_client(const io_device &io_device, bool low_latency, futex_notice_ptr notice = {})
+      : nanomsg_observer(io_device, low_latency, protocol::SUBSCRIBE, std::move(notice), futex_notice::TO_CLIENTS) {
     socket_.connect(connect_path_);
     socket_.setsockopt_str(NN_SUB, NN_SUB_SUBSCRIBE, "");
   }
@@ -137,7 +314,8 @@ public:
 };
 
 io_device::io_device(data::location_ptr home, const bool low_latency, const bool lazy)
-    : home_(std::move(home)), low_latency_(low_latency), lazy_(lazy) {
+    : home_(std::move(home)), low_latency_(low_latency), lazy_(lazy),
+      multi_producer_(std::getenv("KF_JOURNAL_MULTI_PRODUCER") != nullptr) {
   if (spdlog::default_logger()->name().empty()) {
     yijinjing::log::setup_log(home_, home_->name);
   }
@@ -156,11 +334,11 @@ reader_ptr io_device::open_reader_to_subscribe() { return std::make_shared<reade
 }
 
 writer_ptr io_device::open_writer(uint32_t dest_id) {
-  return std::make_shared<writer>(home_, dest_id, lazy_, publisher_);
+  return std::make_shared<writer>(home_, dest_id, lazy_, publisher_, multi_producer_);
 }
 
 writer_ptr io_device::open_writer_at(const data::location_ptr &location, uint32_t dest_id) {
-  return std::make_shared<writer>(location, dest_id, lazy_, publisher_);
+  return std::make_shared<writer>(location, dest_id, lazy_, publisher_, multi_producer_);
 }
 
 [[maybe_unused]] socket_ptr io_device::connect_socket(const data::location_ptr &location, const protocol &p,
@@ -184,8 +362,10 @@ writer_ptr io_device::open_writer_at(const data::location_ptr &location, uint32_
 
 io_device_master::io_device_master(data::location_ptr home, bool low_latency)
     : io_device(std::move(home), low_latency, false) {
-  publisher_ = std::make_shared<nanomsg_publisher_master>(*this, is_low_latency());
-  observer_ = std::make_shared<nanomsg_observer_master>(*this, is_low_latency());
+  auto notice = std::make_shared<futex_notice>(*this);
+  notice->set_enabled(std::getenv("KF_FUTEX_NOTICE") != nullptr);
+  publisher_ = std::make_shared<nanomsg_publisher_master>(*this, is_low_latency(), notice);
+  observer_ = std::make_shared<nanomsg_observer_master>(*this, is_low_latency(), notice);
 }
 
 io_device_client::io_device_client(data::location_ptr home, bool low_latency)
@@ -199,8 +379,9 @@ bool io_device_client::is_usable() {
 }
 
 void io_device_client::setup() {
-  publisher_ = std::make_shared<nanomsg_publisher_client>(*this, is_low_latency());
-  observer_ = std::make_shared<nanomsg_observer_client>(*this, is_low_latency());
+  auto notice = std::make_shared<futex_notice>(*this);
+  publisher_ = std::make_shared<nanomsg_publisher_client>(*this, is_low_latency(), notice);
+  observer_ = std::make_shared<nanomsg_observer_client>(*this, is_low_latency(), notice);
   std::this_thread::sleep_for(std::chrono::milliseconds(SETUP_TIMEOUT));
 }
 } // namespace kungfu::yijinjing
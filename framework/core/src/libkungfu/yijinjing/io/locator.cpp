@@ -5,16 +5,349 @@
 //
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <kungfu/common.h>
 #include <kungfu/yijinjing/common.h>
+#include <map>
+#include <mutex>
 #include <regex>
+#include <set>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif // __linux__
 
 namespace kungfu::yijinjing::data {
 
 namespace fs = std::filesystem;
 namespace es = longfist::enums;
 
+/** depth of journal directories under root: category/group/name/journal/mode */
+constexpr int MODE_DEPTH = 5;
+
+/** journal pages, either as is or archived in compressed form */
+static bool is_journal_file(const fs::path &path) {
+  return path.extension() == ".journal" or path.extension() == ".zjournal";
+}
+
+/** parse {dest_id:08x}.{page_id}.journal */
+static bool parse_page_file(const fs::path &path, uint32_t &dest_id, uint32_t &page_id) {
+  if (not is_journal_file(path)) {
+    return false;
+  }
+  auto basename = path.stem();
+  auto dest_str = basename.stem().string();
+  auto page_str = basename.extension().string();
+  char *end = nullptr;
+  dest_id = std::strtoul(dest_str.c_str(), &end, 16);
+  if (dest_str.empty() or *end != 0 or page_str.size() < 2) {
+    return false;
+  }
+  page_id = std::atoi(page_str.c_str() + 1);
+  return true;
+}
+
+#ifdef __linux__
+/** bumped in child process after fork, so that the inotify instance inherited from parent gets replaced */
+static std::atomic<uint32_t> fork_generation = 0;
+#endif // __linux__
+
+/**
+ * In-memory index of journal directories and their pages under a root, filled by walking the directories once,
+ * then kept up to date by inotify events, which are drained on each query, and by writers registering new pages.
+ * Without inotify, every query goes to the filesystem as before.
+ */
+class locator_index {
+public:
+  explicit locator_index(fs::path root) : root_(std::move(root)) {
+#ifdef __linux__
+    static int atfork = pthread_atfork(nullptr, nullptr, [] { fork_generation++; });
+    generation_ = fork_generation;
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watching_ = atfork == 0 and inotify_fd_ >= 0;
+#endif // __linux__
+  }
+
+  ~locator_index() {
+#ifdef __linux__
+    if (generation_ == fork_generation) {
+      for (auto &pair : watches_) {
+        inotify_rm_watch(inotify_fd_, pair.first);
+      }
+    }
+    watches_.clear();
+    if (inotify_fd_ >= 0) {
+      close(inotify_fd_);
+    }
+#endif // __linux__
+  }
+
+  /** shared by locators of the same root, released along with the last of them */
+  static std::shared_ptr<locator_index> of(const fs::path &root) {
+    static std::mutex registry_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<locator_index>> registry;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto it = registry.begin(); it != registry.end();) {
+      it = it->second.expired() ? registry.erase(it) : std::next(it);
+    }
+    auto &entry = registry[root.string()];
+    auto index = entry.lock();
+    if (not index) {
+      index = std::make_shared<locator_index>(root);
+      entry = index;
+    }
+    return index;
+  }
+
+  /** create directory unless it is known to exist */
+  void ensure_dir(const fs::path &dir) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    renew_after_fork();
+    // known directories are only trusted while inotify keeps them up to date, otherwise ask the filesystem
+    bool cached = watching_ and loaded_;
+    if (cached) {
+      drain_events();
+    }
+    auto path = dir.string();
+    if (cached and watching_ and dirs_.find(path) != dirs_.end()) {
+      return;
+    }
+    if (not fs::exists(dir)) {
+      fs::create_directories(dir);
+    }
+    if (cached) {
+      drain_events(); // get the new directories watched before trusting them
+    }
+    if (cached and watching_) {
+      dirs_.insert(path);
+    } else {
+      dirs_.clear();
+    }
+  }
+
+  std::vector<uint32_t> list_page_id(const fs::path &dir, uint32_t dest_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &dests = refresh(dir);
+    auto it = dests.find(dest_id);
+    return it == dests.end() ? std::vector<uint32_t>{} : std::vector<uint32_t>{it->second.begin(), it->second.end()};
+  }
+
+  std::vector<uint32_t> list_dest(const fs::path &dir) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint32_t> result = {};
+    for (auto &pair : refresh(dir)) {
+      result.push_back(pair.first);
+    }
+    return result;
+  }
+
+  std::vector<std::string> list_journal_dirs() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    renew_after_fork();
+    if (not watching_ or not loaded_) {
+      reload();
+    } else {
+      drain_events();
+    }
+    std::vector<std::string> result = {};
+    for (auto &pair : journals_) {
+      result.push_back(pair.first);
+    }
+    return result;
+  }
+
+  void add_page(const fs::path &dir, uint32_t dest_id, uint32_t page_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    renew_after_fork();
+    if (watching_ and loaded_) {
+      journals_[dir.string()][dest_id].insert(page_id);
+    }
+  }
+
+private:
+  typedef std::map<uint32_t, std::set<uint32_t>> dest_pages;
+
+  const fs::path root_;
+  std::mutex mutex_ = {};
+  bool watching_ = false;
+  bool loaded_ = false;
+  /** journal directory -> dest id -> page ids */
+  std::unordered_map<std::string, dest_pages> journals_ = {};
+  std::unordered_set<std::string> dirs_ = {};
+#ifdef __linux__
+  uint32_t generation_ = 0;
+  int inotify_fd_ = -1;
+  /** watch descriptor -> directory and its depth under root */
+  std::unordered_map<int, std::pair<fs::path, int>> watches_ = {};
+#endif // __linux__
+
+  void renew_after_fork() {
+#ifdef __linux__
+    if (generation_ == fork_generation) {
+      return;
+    }
+    if (inotify_fd_ >= 0) {
+      close(inotify_fd_); // watches stay with parent, which still holds the instance
+    }
+    generation_ = fork_generation;
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watching_ = inotify_fd_ >= 0;
+    watches_.clear();
+    loaded_ = false;
+#endif // __linux__
+  }
+
+  dest_pages &refresh(const fs::path &dir) {
+    renew_after_fork();
+    if (not watching_) {
+      auto &dests = journals_[dir.string()];
+      dests.clear();
+      scan_pages(dir, dests);
+      return dests;
+    }
+    if (not loaded_) {
+      reload();
+    } else {
+      drain_events();
+    }
+    return journals_[dir.string()];
+  }
+
+  void reload() {
+    journals_.clear();
+    dirs_.clear();
+#ifdef __linux__
+    for (auto &pair : watches_) {
+      inotify_rm_watch(inotify_fd_, pair.first);
+    }
+    watches_.clear();
+#endif // __linux__
+    loaded_ = true; // unless a directory to watch is missing, see watch
+    scan(root_, 0);
+  }
+
+  void scan(const fs::path &dir, int depth) {
+    auto layout_name = es::get_layout_name(es::layout::JOURNAL);
+    bool is_journal_dir = depth == MODE_DEPTH and dir.parent_path().filename() == layout_name;
+    if (depth < MODE_DEPTH or is_journal_dir) {
+      watch(dir, depth);
+    }
+    std::error_code ec;
+    if (is_journal_dir) {
+      scan_pages(dir, journals_[dir.string()]);
+      return;
+    }
+    if (depth >= MODE_DEPTH) {
+      return;
+    }
+    for (auto &it : fs::directory_iterator(dir, ec)) {
+      if (it.is_directory(ec)) {
+        scan(it.path(), depth + 1);
+      }
+    }
+  }
+
+  static void scan_pages(const fs::path &dir, dest_pages &dests) {
+    std::error_code ec;
+    for (auto &it : fs::directory_iterator(dir, ec)) {
+      uint32_t dest_id;
+      uint32_t page_id;
+      if (it.is_regular_file(ec) and parse_page_file(it.path(), dest_id, page_id)) {
+        dests[dest_id].insert(page_id);
+      }
+    }
+  }
+
+  void remove(const fs::path &dir) {
+    auto prefix = dir.string();
+    auto covers = [&](const std::string &path) {
+      return path.compare(0, prefix.size(), prefix) == 0 and
+             (path.size() == prefix.size() or fs::path::preferred_separator == path[prefix.size()]);
+    };
+    for (auto it = journals_.begin(); it != journals_.end();) {
+      it = covers(it->first) ? journals_.erase(it) : std::next(it);
+    }
+    for (auto it = dirs_.begin(); it != dirs_.end();) {
+      it = covers(*it) ? dirs_.erase(it) : std::next(it);
+    }
+  }
+
+  void watch([[maybe_unused]] const fs::path &dir, [[maybe_unused]] int depth) {
+#ifdef __linux__
+    if (not watching_) {
+      return;
+    }
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    int wd = inotify_add_watch(inotify_fd_, dir.c_str(), mask);
+    if (wd >= 0) {
+      watches_[wd] = {dir, depth};
+    } else if (errno == ENOENT) {
+      // nothing would tell when it shows up, e.g. root not created yet, rescan on next call instead
+      loaded_ = false;
+    } else {
+      SPDLOG_WARN("can not watch {}, locator index falls back to directory walk: {}", dir.string(), strerror(errno));
+      watching_ = false;
+    }
+#endif // __linux__
+  }
+
+  void drain_events() {
+#ifdef __linux__
+    alignas(struct inotify_event) char buffer[64 * KB];
+    ssize_t length;
+    bool overflow = false;
+    while (watching_ and (length = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+      for (char *p = buffer; p < buffer + length;) {
+        auto event = reinterpret_cast<struct inotify_event *>(p);
+        p += sizeof(struct inotify_event) + event->len;
+        overflow |= (event->mask & IN_Q_OVERFLOW) != 0;
+        auto it = watches_.find(event->wd);
+        if (it == watches_.end()) {
+          continue;
+        }
+        if (event->mask & IN_IGNORED) {
+          watches_.erase(it);
+          continue;
+        }
+        auto path = it->second.first / event->name;
+        auto depth = it->second.second + 1;
+        if (event->mask & IN_ISDIR) {
+          if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            scan(path, depth);
+          } else {
+            remove(path);
+          }
+          overflow |= (event->mask & IN_MOVED_FROM) != 0; // watches under moved directory are left with stale paths
+          continue;
+        }
+        uint32_t dest_id;
+        uint32_t page_id;
+        if (depth > MODE_DEPTH and parse_page_file(path, dest_id, page_id)) {
+          auto &pages = journals_[it->second.first.string()][dest_id];
+          if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            pages.insert(page_id);
+          } else if (not fs::exists(path.parent_path() / fmt::format("{:08x}.{}.journal", dest_id, page_id)) and
+                     not fs::exists(path.parent_path() / fmt::format("{:08x}.{}.zjournal", dest_id, page_id))) {
+            pages.erase(page_id);
+          }
+        }
+      }
+    }
+    if (overflow) {
+      reload();
+    }
+#endif // __linux__
+  }
+};
+
+locator::locator(const std::string &root)
+    : root_(root), dir_mode_(longfist::enums::mode::LIVE), index_(locator_index::of(root_)) {}
+
 fs::path get_default_root() {
   char *kf_home = std::getenv("KF_HOME");
   if (kf_home != nullptr) {
@@ -65,10 +398,11 @@ std::string get_root_dir(es::mode m, const std::vector<std::string> &tags) {
   }
 }
 
-locator::locator() : root_(get_runtime_dir()), dir_mode_(es::mode::LIVE) {}
+locator::locator() : root_(get_runtime_dir()), dir_mode_(es::mode::LIVE), index_(locator_index::of(root_)) {}
 
 locator::locator(es::mode m, const std::vector<std::string> &tags) : dir_mode_(m) {
   root_ = get_root_dir(dir_mode_, tags);
+  index_ = locator_index::of(root_);
 }
 
 bool locator::has_env(const std::string &name) const { return std::getenv(name.c_str()) != nullptr; }
@@ -82,9 +416,7 @@ std::string locator::layout_dir(const location_ptr &location, es::layout layout)
              location->name /                            //
              es::get_layout_name(layout) /               //
              es::get_mode_name(location->mode);
-  if (not fs::exists(dir)) {
-    fs::create_directories(dir);
-  }
+  index_->ensure_dir(dir);
   return dir.string();
 }
 
@@ -110,18 +442,7 @@ std::string locator::layout_file(const location_ptr &location, es::layout layout
 }
 
 std::vector<uint32_t> locator::list_page_id(const location_ptr &location, uint32_t dest_id) const {
-  std::vector<uint32_t> result = {};
-  auto dest_id_str = fmt::format("{:08x}", dest_id);
-  auto dir = fs::path(layout_dir(location, es::layout::JOURNAL));
-  for (auto &it : fs::recursive_directory_iterator(dir)) {
-    auto basename = it.path().stem();
-    if (it.is_regular_file() and it.path().extension() == ".journal" and basename.stem() == dest_id_str) {
-      auto index = std::atoi(basename.extension().string().c_str() + 1);
-      result.push_back(index);
-    }
-  }
-  std::sort(result.begin(), result.end());
-  return result;
+  return index_->list_page_id(layout_dir(location, es::layout::JOURNAL), dest_id);
 }
 
 static constexpr auto w = [](const std::string &pattern) { return pattern == "*" ? ".*" : pattern; };
@@ -135,9 +456,8 @@ std::vector<location_ptr> locator::list_locations(const std::string &category, c
   std::regex search_regex(pattern);
   std::vector<location_ptr> result = {};
   std::smatch match;
-  for (auto &it : fs::recursive_directory_iterator(root_)) {
-    auto path = it.path().string();
-    if (it.is_directory() and std::regex_match(path, match, search_regex)) {
+  for (auto &path : index_->list_journal_dirs()) {
+    if (std::regex_match(path, match, search_regex)) {
       auto l = location::make_shared(es::get_mode_by_name(match[4].str()),     //
                                      es::get_category_by_name(match[1].str()), //
                                      match[2].str(),                           //
@@ -150,15 +470,7 @@ std::vector<location_ptr> locator::list_locations(const std::string &category, c
 }
 
 std::vector<uint32_t> locator::list_location_dest(const location_ptr &location) const {
-  std::unordered_set<uint32_t> set = {};
-  auto dir = fs::path(layout_dir(location, es::layout::JOURNAL));
-  for (auto &it : fs::recursive_directory_iterator(dir)) {
-    auto basename = it.path().stem();
-    if (it.is_regular_file() and it.path().extension() == ".journal") {
-      set.emplace(std::stoul(basename.stem(), nullptr, 16));
-    }
-  }
-  return std::vector<uint32_t>{set.begin(), set.end()};
+  return index_->list_dest(layout_dir(location, es::layout::JOURNAL));
 }
 
 std::vector<uint32_t> locator::list_location_dest_by_db(const location_ptr &location) const {
@@ -173,6 +485,10 @@ std::vector<uint32_t> locator::list_location_dest_by_db(const location_ptr &loca
   return std::vector<uint32_t>{set.begin(), set.end()};
 }
 
+void locator::register_page(const location_ptr &location, uint32_t dest_id, uint32_t page_id) const {
+  index_->add_page(layout_dir(location, es::layout::JOURNAL), dest_id, page_id);
+}
+
 bool locator::operator==(const locator &another) const {
   return dir_mode_ == another.dir_mode_ and root_.string() == another.root_.string();
 }
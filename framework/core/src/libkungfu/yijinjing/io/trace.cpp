@@ -3,6 +3,7 @@
 //
 // Created by Keren Dong on 2020/3/25.
 //
+#include <filesystem>
 #include <fstream>
 #include <kungfu/common.h>
 #include <kungfu/yijinjing/io.h>
@@ -74,16 +75,159 @@ struct console_table {
   }
 };
 
-io_device_console::io_device_console(data::location_ptr home, int32_t console_width, int32_t console_height)
-    : io_device(std::move(home), false, true), console_width_(console_width), console_height_(console_height) {}
+/**
+ * numpy style dtype of fixed width column, char arrays are byte strings, other arrays sub-arrays of their element
+ */
+template <typename T> std::string column_dtype() {
+  if constexpr (is_array_v<T>) {
+    using ElementType = typename T::element_type;
+    if constexpr (std::is_same_v<ElementType, char>) {
+      return fmt::format("|S{}", T::length);
+    } else {
+      return fmt::format("({},){}", T::length, column_dtype<ElementType>());
+    }
+  } else if constexpr (std::is_enum_v<T>) {
+    return column_dtype<std::underlying_type_t<T>>();
+  } else if constexpr (std::is_same_v<T, bool>) {
+    return "|b1";
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return fmt::format("<f{}", sizeof(T));
+  } else if constexpr (std::is_integral_v<T>) {
+    return fmt::format("<{}{}", std::is_signed_v<T> ? 'i' : 'u', sizeof(T));
+  } else {
+    return fmt::format("|V{}", sizeof(T));
+  }
+}
 
-[[maybe_unused]] void io_device_console::trace(int64_t begin_time, int64_t end_time, bool in, bool out,
-                                               std::string csv) {
-  std::unordered_map<uint32_t, location_ptr> locations = {};
-  for (auto location : home_->locator->list_locations(".*", ".*", ".*", ".*")) {
-    locations.emplace(location->uid, location);
+/**
+ * columnar binary file of one msg type, all in little endian:
+ *   file header:   char magic[8] "KFCOL01", int32 msg_type, uint32 column_count, uint64 row_count
+ *   column schema: char name[48], char dtype[12], uint32 width, for each column
+ *   row groups:    uint32 rows, then rows * width bytes of each column in schema order, until end of file
+ */
+class column_file {
+public:
+  static constexpr uint32_t GROUP_ROWS = 64 * 1024;
+
+  struct file_header {
+    char magic[8];
+    int32_t msg_type;
+    uint32_t column_count;
+    uint64_t row_count;
+  };
+
+  struct column_schema {
+    char name[48];
+    char dtype[12];
+    uint32_t width;
+  };
+
+  template <typename DataType> static std::unique_ptr<column_file> make(const std::string &output_dir) {
+    auto path = fmt::format("{}/{}.kfcol", output_dir, DataType::type_name.c_str());
+    auto file = std::unique_ptr<column_file>(new column_file(path));
+    file->header_.msg_type = DataType::tag;
+    file->add_header_column<int64_t>("gen_time", offsetof(frame_header, gen_time));
+    file->add_header_column<int64_t>("trigger_time", offsetof(frame_header, trigger_time));
+    file->add_header_column<uint32_t>("source", offsetof(frame_header, source));
+    file->add_header_column<uint32_t>("dest", offsetof(frame_header, dest));
+    if constexpr (DataType::has_data) {
+      DataType sample = {};
+      boost::hana::for_each(boost::hana::accessors<DataType>(), [&](auto it) {
+        auto accessor = boost::hana::second(it);
+        auto member_pointer = member_pointer_trait<decltype(accessor)>().pointer();
+        using MemberType = std::decay_t<decltype(accessor(DataType{}))>;
+        auto offset = reinterpret_cast<uintptr_t>(&(sample.*member_pointer)) - reinterpret_cast<uintptr_t>(&sample);
+        file->add_column(boost::hana::first(it).c_str(), column_dtype<MemberType>(), sizeof(MemberType), false,
+                         offset);
+      });
+    }
+    file->write_schema();
+    return file;
+  }
+
+  ~column_file() {
+    flush();
+    header_.row_count = row_count_;
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+  }
+
+  void append(const frame_ptr &frame) {
+    auto header_address = reinterpret_cast<const char *>(frame->address());
+    auto data_address = reinterpret_cast<const char *>(frame->data_address());
+    for (auto &column : columns_) {
+      // payload written by an older version of the type may be shorter, the rest is left zero
+      auto source = (column.from_header ? header_address : data_address) + column.offset;
+      auto length = column.from_header ? frame->header_length() : frame->data_length();
+      auto target = column.buffer.data() + size_t(group_rows_) * column.width;
+      memset(target, 0, column.width);
+      if (column.offset < length) {
+        memcpy(target, source, std::min<uintptr_t>(column.width, length - column.offset));
+      }
+    }
+    if (++group_rows_ == GROUP_ROWS) {
+      flush();
+    }
+  }
+
+private:
+  struct column {
+    column_schema schema;
+    uint32_t width;
+    bool from_header;
+    uintptr_t offset;
+    std::vector<char> buffer;
+  };
+
+  std::ofstream out_;
+  file_header header_ = {"KFCOL01", 0, 0, 0};
+  std::vector<column> columns_ = {};
+  uint32_t group_rows_ = 0;
+  uint64_t row_count_ = 0;
+
+  explicit column_file(const std::string &path) : out_(path, std::ios::binary | std::ios::trunc) {
+    if (not out_.is_open()) {
+      throw yijinjing_error("unable to open " + path);
+    }
+  }
+
+  template <typename T> void add_header_column(const char *name, uintptr_t offset) {
+    add_column(name, column_dtype<T>(), sizeof(T), true, offset);
+  }
+
+  void add_column(const char *name, const std::string &dtype, uint32_t width, bool from_header, uintptr_t offset) {
+    column_schema schema = {};
+    strncpy(schema.name, name, sizeof(schema.name) - 1);
+    strncpy(schema.dtype, dtype.c_str(), sizeof(schema.dtype) - 1);
+    schema.width = width;
+    columns_.push_back({schema, width, from_header, offset, std::vector<char>(size_t(width) * GROUP_ROWS)});
+  }
+
+  void write_schema() {
+    header_.column_count = columns_.size();
+    out_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+    for (auto &column : columns_) {
+      out_.write(reinterpret_cast<const char *>(&column.schema), sizeof(column.schema));
+    }
+  }
+
+  void flush() {
+    if (group_rows_ == 0) {
+      return;
+    }
+    out_.write(reinterpret_cast<const char *>(&group_rows_), sizeof(group_rows_));
+    for (auto &column : columns_) {
+      out_.write(column.buffer.data(), size_t(group_rows_) * column.width);
+    }
+    row_count_ += group_rows_;
+    group_rows_ = 0;
   }
+};
+
+io_device_console::io_device_console(data::location_ptr home, int32_t console_width, int32_t console_height)
+    : io_device(std::move(home), false, true), console_width_(console_width), console_height_(console_height) {}
 
+journal::reader_ptr io_device_console::open_trace_reader(int64_t begin_time, bool in, bool out) {
   auto reader = open_reader_to_subscribe();
 
   if (in) {
@@ -99,6 +243,42 @@ io_device_console::io_device_console(data::location_ptr home, int32_t console_wi
       reader->join(home_, dest_id, begin_time);
     }
   }
+  return reader;
+}
+
+void io_device_console::follow_trace_requests(const reader_ptr &reader, const frame_ptr &frame,
+                                              const std::unordered_map<uint32_t, location_ptr> &locations) {
+  if (frame->dest() != home_->uid) {
+    return;
+  }
+  if (frame->msg_type() == RequestReadFrom::tag) {
+    auto request = frame->data<RequestReadFrom>();
+    auto source_location = locations.at(request.source_id);
+    reader->join(source_location, home_->uid, request.from_time);
+  }
+  if (frame->msg_type() == RequestReadFromPublic::tag) {
+    auto request = frame->data<RequestReadFromPublic>();
+    auto source_location = locations.at(request.source_id);
+    reader->join(source_location, location::PUBLIC, request.from_time);
+  }
+  if (frame->msg_type() == RequestReadFromSync::tag) {
+    auto request = frame->data<RequestReadFromSync>();
+    auto source_location = locations.at(request.source_id);
+    reader->join(source_location, location::SYNC, request.from_time);
+  }
+  if (frame->msg_type() == Deregister::tag) {
+    reader->disjoin(location::make_shared(frame->data<Deregister>(), get_locator())->uid);
+  }
+}
+
+[[maybe_unused]] void io_device_console::trace(int64_t begin_time, int64_t end_time, bool in, bool out,
+                                               std::string csv) {
+  std::unordered_map<uint32_t, location_ptr> locations = {};
+  for (auto location : home_->locator->list_locations(".*", ".*", ".*", ".*")) {
+    locations.emplace(location->uid, location);
+  }
+
+  auto reader = open_trace_reader(begin_time, in, out);
 
   console_table table(console_width_, console_height_);
   std::ofstream of_csv;
@@ -149,24 +329,7 @@ io_device_console::io_device_console(data::location_ptr home, int32_t console_wi
       SPDLOG_ERROR("{}/{:08x} msg_type {} not found", location_uname, dest_id, frame->msg_type());
       break;
     }
-    if (frame->dest() == home_->uid and frame->msg_type() == RequestReadFrom::tag) {
-      auto request = frame->data<RequestReadFrom>();
-      auto source_location = locations.at(request.source_id);
-      reader->join(source_location, home_->uid, request.from_time);
-    }
-    if (frame->dest() == home_->uid and frame->msg_type() == RequestReadFromPublic::tag) {
-      auto request = frame->data<RequestReadFromPublic>();
-      auto source_location = locations.at(request.source_id);
-      reader->join(source_location, location::PUBLIC, request.from_time);
-    }
-    if (frame->dest() == home_->uid and frame->msg_type() == RequestReadFromSync::tag) {
-      auto request = frame->data<RequestReadFromSync>();
-      auto source_location = locations.at(request.source_id);
-      reader->join(source_location, location::SYNC, request.from_time);
-    }
-    if (frame->dest() == home_->uid and frame->msg_type() == Deregister::tag) {
-      reader->disjoin(location::make_shared(frame->data<Deregister>(), get_locator())->uid);
-    }
+    follow_trace_requests(reader, frame, locations);
     reader->next();
   }
   if (!csv.empty()) {
@@ -181,21 +344,7 @@ io_device_console::io_device_console(data::location_ptr home, int32_t console_wi
     locations.emplace(location->uid, location);
   }
 
-  auto reader = open_reader_to_subscribe();
-
-  if (in) {
-    auto uid_str = fmt::format("{:08x}", home_->uid);
-    auto master_cmd_location = location::make_shared(mode::LIVE, category::SYSTEM, "master", uid_str, get_locator());
-    auto master_home_location = location::make_shared(mode::LIVE, category::SYSTEM, "master", "master", get_locator());
-
-    reader->join(master_cmd_location, home_->uid, begin_time);
-    reader->join(master_home_location, location::PUBLIC, begin_time);
-  }
-  if (out) {
-    for (auto dest_id : get_locator()->list_location_dest(home_)) {
-      reader->join(home_, dest_id, begin_time);
-    }
-  }
+  auto reader = open_trace_reader(begin_time, in, out);
 
   console_table table(console_width_, console_height_, true);
   std::ofstream of_csv;
@@ -245,28 +394,49 @@ io_device_console::io_device_console(data::location_ptr home, int32_t console_wi
       SPDLOG_ERROR("{}/{:08x} msg_type {} not found", location_uname, dest_id, frame->msg_type());
       break;
     }
-    if (frame->dest() == home_->uid and frame->msg_type() == RequestReadFrom::tag) {
-      auto request = frame->data<RequestReadFrom>();
-      auto source_location = locations.at(request.source_id);
-      reader->join(source_location, home_->uid, request.from_time);
-    }
-    if (frame->dest() == home_->uid and frame->msg_type() == RequestReadFromPublic::tag) {
-      auto request = frame->data<RequestReadFromPublic>();
-      auto source_location = locations.at(request.source_id);
-      reader->join(source_location, location::PUBLIC, request.from_time);
-    }
-    if (frame->dest() == home_->uid and frame->msg_type() == RequestReadFromSync::tag) {
-      auto request = frame->data<RequestReadFromSync>();
-      auto source_location = locations.at(request.source_id);
-      reader->join(source_location, location::SYNC, request.from_time);
-    }
-    if (frame->dest() == home_->uid and frame->msg_type() == Deregister::tag) {
-      reader->disjoin(location::make_shared(frame->data<Deregister>(), get_locator())->uid);
-    }
+    follow_trace_requests(reader, frame, locations);
     reader->next();
   }
   if (!csv.empty()) {
     of_csv.close();
   }
 }
-} // namespace kungfu::yijinjing
\ No newline at end of file
+
+[[maybe_unused]] void io_device_console::export_columns(int64_t begin_time, int64_t end_time, bool in, bool out,
+                                                        const std::string &output_dir) {
+  std::unordered_map<uint32_t, location_ptr> locations = {};
+  for (auto location : home_->locator->list_locations(".*", ".*", ".*", ".*")) {
+    locations.emplace(location->uid, location);
+  }
+
+  std::filesystem::create_directories(output_dir);
+  auto reader = open_trace_reader(begin_time, in, out);
+  // schema is resolved once per msg type, frames are then copied column by column without going through hana
+  std::unordered_map<int32_t, std::unique_ptr<column_file>> files = {};
+  while (reader->data_available() and reader->current_frame()->gen_time() <= end_time) {
+    auto frame = reader->current_frame();
+    auto msg_type = frame->msg_type();
+    auto it = files.find(msg_type);
+    if (it == files.end()) {
+      std::unique_ptr<column_file> file = {};
+      boost::hana::for_each(AllTypes, [&](auto type) {
+        using DataType = typename decltype(+boost::hana::second(type))::type;
+        if constexpr (size_fixed_v<DataType>) {
+          if (msg_type == DataType::tag) {
+            file = column_file::make<DataType>(output_dir);
+          }
+        }
+      });
+      if (not file) {
+        SPDLOG_WARN("msg_type {} has no fixed width layout, skipped", msg_type);
+      }
+      it = files.emplace(msg_type, std::move(file)).first;
+    }
+    if (it->second) {
+      it->second->append(frame);
+    }
+    follow_trace_requests(reader, frame, locations);
+    reader->next();
+  }
+}
+} // namespace kungfu::yijinjing
@@ -5,6 +5,10 @@
 // Created by Keren Dong on 2020/5/22.
 //
 
+#include <atomic>
+#include <map>
+#include <thread>
+
 #include <kungfu/yijinjing/cache/backend.h>
 #include <kungfu/yijinjing/common.h>
 #include <kungfu/yijinjing/io.h>
@@ -34,13 +38,18 @@ publisher_ptr sink::get_publisher() { return publisher_; }
 copy_sink::copy_sink(data::locator_ptr locator) : sink(), locator_(std::move(locator)) {}
 
 void copy_sink::put(const data::location_ptr &location, uint32_t dest_id, const frame_ptr &frame) {
-  auto pair = writers_.try_emplace(location->uid);
-  auto &writers = pair.first->second;
-  if (writers.find(dest_id) == writers.end()) {
-    auto target_location = data::location::make_shared(*location, locator_);
-    writers.try_emplace(dest_id, std::make_shared<writer>(target_location, dest_id, true, get_publisher()));
+  writer_ptr target_writer;
+  {
+    std::lock_guard<std::mutex> lock(writers_mutex_);
+    auto pair = writers_.try_emplace(location->uid);
+    auto &writers = pair.first->second;
+    if (writers.find(dest_id) == writers.end()) {
+      auto target_location = data::location::make_shared(*location, locator_);
+      writers.try_emplace(dest_id, std::make_shared<writer>(target_location, dest_id, true, get_publisher()));
+    }
+    target_writer = writers.at(dest_id);
   }
-  writers.at(dest_id)->copy_frame(frame);
+  target_writer->copy_frame(frame);
 }
 
 assemble::assemble(const std::string &mode, const std::string &category, const std::string &group,
@@ -134,6 +143,10 @@ assemble &assemble::operator-=(const assemble &other) {
 }
 
 void assemble::operator>>(const sink_ptr &sink) {
+  if (sink->is_partitionable()) {
+    put_partitioned(sink);
+    return;
+  }
   while (data_available()) {
     auto page = current_reader_->current_page();
     sink->put(page->get_location(), page->get_dest_id(), current_frame());
@@ -141,6 +154,74 @@ void assemble::operator>>(const sink_ptr &sink) {
   }
 }
 
+void assemble::put_partitioned(const sink_ptr &sink) {
+  // journals of the same location/dest from different locators, in order of readers
+  std::map<uint64_t, std::vector<journal *>> partition_map = {};
+  for (auto &reader : readers_) {
+    for (auto &pair : reader->journals_) {
+      partition_map[pair.first].push_back(&pair.second);
+    }
+  }
+  std::vector<std::vector<journal *>> partitions = {};
+  for (auto &pair : partition_map) {
+    partitions.push_back(std::move(pair.second));
+  }
+
+  std::atomic<size_t> next_partition = 0;
+  std::atomic<bool> failed = false;
+  std::exception_ptr error = nullptr;
+  std::mutex error_mutex;
+  // same as the full merge, stops at frames not generated yet, ties go to the earlier reader
+  auto drain = [&]() {
+    try {
+      int64_t now = time::now_in_nano();
+      for (size_t i = next_partition++; i < partitions.size() and not failed; i = next_partition++) {
+        while (not failed) {
+          journal *earliest = nullptr;
+          for (auto j : partitions[i]) {
+            auto gen_time = j->current_frame()->gen_time();
+            if (j->current_frame()->has_data() and
+                (earliest == nullptr or gen_time < earliest->current_frame()->gen_time())) {
+              earliest = j;
+            }
+          }
+          if (earliest == nullptr) {
+            break;
+          }
+          auto gen_time = earliest->current_frame()->gen_time();
+          if (gen_time > now and gen_time > (now = time::now_in_nano())) {
+            break;
+          }
+          auto page = earliest->current_page();
+          sink->put(page->get_location(), page->get_dest_id(), earliest->current_frame());
+          earliest->next();
+        }
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      error = error == nullptr ? std::current_exception() : error;
+      failed = true;
+    }
+  };
+  auto thread_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), partitions.size());
+  std::vector<std::thread> threads = {};
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(drain);
+  }
+  drain();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto &reader : readers_) {
+    reader->current_ = nullptr;
+    reader->rebuild();
+  }
+  sort();
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+
 bool assemble::data_available() {
   sort();
   //  for (auto &reader : readers_) {
@@ -159,7 +240,7 @@ void assemble::next() {
   sort();
 }
 
-frame_ptr assemble::current_frame() { return current_reader_->current_frame(); }
+const frame_ptr &assemble::current_frame() { return current_reader_->current_frame(); }
 
 void assemble::sort() {
   int64_t min_time = INT64_MAX;
@@ -235,18 +316,29 @@ assemble::assemble(const data::location_ptr &source_location, uint32_t dest_id,
   return v;
 }
 
-std::vector<std::pair<longfist::types::frame_header, std::vector<uint8_t>>> assemble::read_bytes(int32_t msg_type,
-                                                                                                 int64_t end_time) {
-  std::vector<std::pair<longfist::types::frame_header, std::vector<uint8_t>>> v{};
-  while (data_available() and current_frame()->gen_time() < end_time) {
-    if (msg_type == 0 or current_frame()->msg_type() == msg_type) {
-      const frame_header &head = *reinterpret_cast<frame_header *>(current_frame()->address());
-      std::vector<uint8_t> bytes{current_frame()->data_as_bytes(),
-                                 current_frame()->data_as_bytes() + current_frame()->data_length()};
-      v.emplace_back(head, bytes);
+void assemble::read_spans(int32_t msg_type, int64_t end_time,
+                          const std::function<void(const frame_span &)> &visit) {
+  while (data_available()) {
+    auto &frame = current_frame();
+    if (frame->gen_time() >= end_time) {
+      break;
+    }
+    if (msg_type == 0 or frame->msg_type() == msg_type) {
+      visit({reinterpret_cast<const frame_header *>(frame->address()),
+             reinterpret_cast<const uint8_t *>(frame->data_address()), frame->data_length()});
     }
     next();
   }
+}
+
+std::vector<std::pair<longfist::types::frame_header, std::vector<uint8_t>>> assemble::read_bytes(int32_t msg_type,
+                                                                                                 int64_t end_time) {
+  std::vector<std::pair<longfist::types::frame_header, std::vector<uint8_t>>> v{};
+  // the caller owns the result, copy each frame straight from page into its slot
+  read_spans(msg_type, end_time, [&](const frame_span &span) {
+    v.emplace_back(std::piecewise_construct, std::forward_as_tuple(*span.header),
+                   std::forward_as_tuple(span.data, span.data + span.length));
+  });
   return v;
 }
 
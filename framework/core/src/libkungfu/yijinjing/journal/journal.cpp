@@ -1,13 +1,97 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <thread>
+
 #include <kungfu/common.h>
 #include <kungfu/longfist/longfist.h>
 #include <kungfu/yijinjing/journal/journal.h>
 #include <kungfu/yijinjing/journal/page.h>
 #include <kungfu/yijinjing/time.h>
+#include <kungfu/yijinjing/util/os.h>
 
 namespace kungfu::yijinjing::journal {
 
+static double init_page_preload_threshold() {
+  char *threshold = std::getenv("KF_PAGE_PRELOAD_THRESHOLD");
+  return threshold == nullptr ? 0.5 : std::atof(threshold);
+}
+
+static std::atomic<double> page_preload_threshold = init_page_preload_threshold();
+
+void journal::set_page_preload_threshold(double threshold) { page_preload_threshold = threshold; }
+
+/**
+ * one helper thread preloads pages for all writers of the process, in the order they ask
+ */
+class page_preloader {
+public:
+  ~page_preloader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    condition_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  std::future<page_ptr> request(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id, bool lazy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (not thread_.joinable()) {
+      thread_ = std::thread(&page_preloader::run, this);
+    }
+    auto &request = requests_.emplace_back(preload_request{location, dest_id, page_id, lazy, {}});
+    auto future = request.promise.get_future();
+    condition_.notify_one();
+    return future;
+  }
+
+private:
+  struct preload_request {
+    data::location_ptr location;
+    uint32_t dest_id;
+    uint32_t page_id;
+    bool lazy;
+    std::promise<page_ptr> promise;
+  };
+
+  std::mutex mutex_ = {};
+  std::condition_variable condition_ = {};
+  std::deque<preload_request> requests_ = {};
+  std::thread thread_ = {};
+  bool stopped_ = false;
+
+  void run() {
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [&] { return stopped_ or not requests_.empty(); });
+      if (stopped_) {
+        return;
+      }
+      auto request = std::move(requests_.front());
+      requests_.pop_front();
+      lock.unlock();
+      try {
+        request.promise.set_value(page::preload(request.location, request.dest_id, request.page_id, request.lazy));
+      } catch (const std::exception &e) {
+        SPDLOG_WARN("failed to preload page {}/{:08x}.{}.journal: {}", request.location->uname, request.dest_id,
+                    request.page_id, e.what());
+        request.promise.set_value(nullptr);
+      }
+    }
+  }
+};
+
+static page_preloader &get_page_preloader() {
+  static page_preloader preloader;
+  return preloader;
+}
+
 journal::~journal() {
   if (page_.get() != nullptr) {
     page_.reset();
@@ -21,27 +105,64 @@ void journal::next() {
   } else {
     frame_->move_to_next();
     page_frame_nb_++;
+    if (frame_->address() >= preload_address_) {
+      preload_next_page();
+    }
   }
 }
 
 void journal::seek_to_time(int64_t nanotime) {
-  int page_id = page::find_page_id(location_, dest_id_, nanotime);
+  uint32_t page_id = page::find_page_id(location_, dest_id_, nanotime);
+  if (is_writing_ and std::filesystem::exists(page::get_compressed_page_path(location_, dest_id_, page_id)) and
+      not std::filesystem::exists(page::get_page_path(location_, dest_id_, page_id))) {
+    // archived page is read only, writer carries on with the page after it
+    page_id++;
+  }
   load_page(page_id);
   while (page_->is_full() && page_->end_time() <= nanotime) {
     load_next_page();
   }
+  auto [frame_nb, frame_address] = page_->seek_frame_index(nanotime);
+  frame_->set_address(frame_address);
+  page_frame_nb_ = frame_nb;
   while (frame_->has_data() && frame_->gen_time() <= nanotime) {
     next();
   }
 }
 
-void journal::load_page(int page_id) {
+void journal::load_page(uint32_t page_id) {
   if (page_.get() == nullptr or page_->get_page_id() != page_id) {
-    page_ = page::load(location_, dest_id_, page_id, is_writing_, lazy_);
+    page_ptr preloaded = take_preloaded_page();
+    if (preloaded and preloaded->get_page_id() == page_id and preloaded->publish()) {
+      page_ = preloaded;
+    } else {
+      page_ = page::load(location_, dest_id_, page_id, is_writing_, lazy_);
+    }
   }
   frame_->set_address(page_->first_frame_address());
   page_frame_nb_ = 0u;
+  double threshold = page_preload_threshold;
+  bool preload = is_writing_ and threshold > 0 and threshold < 1;
+  preload_address_ = preload ? page_->address() + uintptr_t(page_->get_page_size() * threshold) : UINTPTR_MAX;
 }
 
 void journal::load_next_page() { load_page(page_->get_page_id() + 1); }
+
+void journal::preload_next_page() {
+  preload_address_ = UINTPTR_MAX;
+  if (not next_page_.valid()) {
+    next_page_ = get_page_preloader().request(location_, dest_id_, page_->get_page_id() + 1, lazy_);
+  }
+}
+
+page_ptr journal::take_preloaded_page() {
+  if (not next_page_.valid()) {
+    return nullptr;
+  }
+  try {
+    return next_page_.get();
+  } catch (const std::future_error &) {
+    return nullptr; // preloader stopped at exit
+  }
+}
 } // namespace kungfu::yijinjing::journal
\ No newline at end of file
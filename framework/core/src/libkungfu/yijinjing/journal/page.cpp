@@ -1,11 +1,61 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
 #include <kungfu/common.h>
 #include <kungfu/yijinjing/journal/page.h>
 #include <kungfu/yijinjing/util/os.h>
+#include <kungfu/yijinjing/util/util.h>
 
 namespace kungfu::yijinjing::journal {
 using namespace longfist::types;
+using namespace longfist::enums;
+
+static void parse_mmap_hint_env(std::array<std::atomic<uint32_t>, 4> &hints, const char *env_name, uint32_t hint) {
+  char *env_value = std::getenv(env_name);
+  if (env_value == nullptr) {
+    return;
+  }
+  static constexpr std::array categories = {category::MD, category::TD, category::STRATEGY, category::SYSTEM};
+  std::stringstream names(env_value);
+  std::string name;
+  while (std::getline(names, name, ',')) {
+    name.erase(std::remove_if(name.begin(), name.end(), ::isspace), name.end());
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    auto match = [&](category c) { return get_category_name(c) == name; };
+    auto found = std::find_if(categories.begin(), categories.end(), match);
+    if (found == categories.end()) {
+      SPDLOG_WARN("unknown category {} in {}, ignored", name, env_name);
+      continue;
+    }
+    hints[static_cast<size_t>(*found)] |= hint;
+  }
+}
+
+static std::atomic<bool> frame_checksum_enabled = std::getenv("KF_JOURNAL_CHECKSUM") != nullptr;
+
+/**
+ * per category mmap hints, atomic as they can be set while other threads are loading pages
+ */
+struct page_mmap_hints {
+  std::array<std::atomic<uint32_t>, 4> hints = {};
+
+  page_mmap_hints() {
+    parse_mmap_hint_env(hints, "KF_PAGE_MMAP_POPULATE", os::MMAP_POPULATE);
+    parse_mmap_hint_env(hints, "KF_PAGE_MMAP_HUGE_PAGES", os::MMAP_HUGE_PAGES);
+  }
+
+  static std::atomic<uint32_t> &of(category category) {
+    static page_mmap_hints instance = {};
+    return instance.hints[static_cast<size_t>(category)];
+  }
+};
 
 page::page(data::location_ptr location, uint32_t dest_id, const uint32_t page_id, const size_t size, const bool lazy,
            uintptr_t address)
@@ -18,6 +68,18 @@ page::~page() {
   if (not os::release_mmap_buffer(address(), size_, lazy_)) {
     SPDLOG_ERROR("can not release page {}/{:08x}.{}.journal", location_->uname, dest_id_, page_id_);
   }
+  auto frame_index_size = frame_index_capacity_ * sizeof(frame_index_entry);
+  if (frame_index_ != nullptr and not os::release_mmap_buffer(uintptr_t(frame_index_), frame_index_size, true)) {
+    SPDLOG_ERROR("can not release frame index {}/{:08x}.{}.index", location_->uname, dest_id_, page_id_);
+  }
+  auto checksums_size = checksums_capacity_ * sizeof(uint32_t);
+  if (checksums_ != nullptr and not os::release_mmap_buffer(uintptr_t(checksums_), checksums_size, true)) {
+    SPDLOG_ERROR("can not release checksums {}/{:08x}.{}.sum", location_->uname, dest_id_, page_id_);
+  }
+  std::error_code ec;
+  if (not preload_path_.empty() and not std::filesystem::remove(preload_path_, ec)) {
+    SPDLOG_WARN("can not remove preloaded page {}: {}", preload_path_, ec.message());
+  }
 }
 
 void page::set_last_frame_position(uint64_t position) {
@@ -28,7 +90,14 @@ page_ptr page::load(const data::location_ptr &location, uint32_t dest_id, uint32
                     bool lazy) {
   uint32_t page_size = find_page_size(location, dest_id);
   std::string path = get_page_path(location, dest_id, page_id);
-  uintptr_t address = os::load_mmap_buffer(path, page_size, is_writing, lazy);
+  std::string compressed_path = get_compressed_page_path(location, dest_id, page_id);
+  bool compressed = not std::filesystem::exists(path) and std::filesystem::exists(compressed_path);
+  if (compressed and is_writing) {
+    throw journal_error("can not write to archived page " + compressed_path);
+  }
+  uint32_t hints = get_mmap_hints(location->category);
+  uintptr_t address = compressed ? load_compressed(compressed_path, page_size)
+                                 : os::load_mmap_buffer(path, page_size, is_writing, lazy, hints);
 
   // SPDLOG_TRACE("load page {}/{:08x}.{}.journal", location->uname, dest_id, page_id);
   // SPDLOG_TRACE("page_size {}, address {}", page_size, address);
@@ -38,7 +107,9 @@ page_ptr page::load(const data::location_ptr &location, uint32_t dest_id, uint32
   }
 
   page_header *header = reinterpret_cast<page_header *>(address);
-  if (header->last_frame_position == 0) {
+  bool is_new_page = header->last_frame_position == 0;
+  if (is_new_page) {
+    location->locator->register_page(location, dest_id, page_id);
     header->version = __JOURNAL_VERSION__;
     header->page_header_length = sizeof(page_header);
     header->page_size = page_size;
@@ -61,15 +132,346 @@ page_ptr page::load(const data::location_ptr &location, uint32_t dest_id, uint32
                     page_size, s, location->uname, path, dest_id, page_id));
   }
 
-  return std::shared_ptr<page>(new page(location, dest_id, page_id, page_size, lazy, address));
+  auto result = std::shared_ptr<page>(new page(location, dest_id, page_id, page_size, lazy or compressed, address));
+  if (is_writing) {
+    result->load_frame_index(true, is_new_page);
+    // checksums left by writing with checksum disabled in between would no longer match, start over
+    result->load_checksums(frame_checksum_enabled, is_new_page or not frame_checksum_enabled);
+    if (not is_new_page) {
+      result->recover_tail();
+    }
+  }
+  return result;
+}
+
+page_ptr page::preload(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id, bool lazy) {
+  uint32_t page_size = find_page_size(location, dest_id);
+  auto path = get_page_path(location, dest_id, page_id) + ".preload";
+  std::error_code ec;
+  std::filesystem::remove(path, ec); // left by a writer that did not get to switch pages
+  auto address = os::load_mmap_buffer(path, page_size, true, lazy, get_mmap_hints(location->category));
+  if (address == 0) {
+    throw journal_error("unable to preload page " + path);
+  }
+  os::prefault_mmap_buffer(address, page_size, true);
+  auto header = reinterpret_cast<page_header *>(address);
+  header->version = __JOURNAL_VERSION__;
+  header->page_header_length = sizeof(page_header);
+  header->page_size = page_size;
+  header->frame_header_length = sizeof(frame_header);
+  header->last_frame_position = header->page_header_length;
+  auto result = std::shared_ptr<page>(new page(location, dest_id, page_id, page_size, lazy, address));
+  result->preload_path_ = path;
+  return result;
+}
+
+bool page::publish() {
+  auto path = get_page_path(location_, dest_id_, page_id_);
+  if (exists(location_, dest_id_, page_id_)) {
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(preload_path_, path, ec);
+  if (ec) {
+    SPDLOG_WARN("can not publish preloaded page {}: {}", path, ec.message());
+    return false;
+  }
+  preload_path_.clear();
+  location_->locator->register_page(location_, dest_id_, page_id_);
+  load_frame_index(true, true);
+  load_checksums(frame_checksum_enabled, true);
+  return true;
+}
+
+uintptr_t page::load_sidecar(const std::string &name, size_t size, bool is_writing, bool reset) {
+  auto dir = std::filesystem::path(location_->locator->layout_dir(location_, layout::JOURNAL));
+  auto path = dir / fmt::format("{:08x}.{}.{}", dest_id_, page_id_, name);
+  std::error_code ec;
+  if (reset) {
+    std::filesystem::remove(path, ec);
+  }
+  if (not is_writing and (not std::filesystem::exists(path, ec) or std::filesystem::file_size(path, ec) < size)) {
+    return 0;
+  }
+  try {
+    return os::load_mmap_buffer(path.string(), size, is_writing, true);
+  } catch (const journal_error &e) {
+    SPDLOG_WARN("{} not available for {}/{:08x}.{}: {}", name, location_->uname, dest_id_, page_id_, e.what());
+    return 0;
+  }
+}
+
+void page::load_frame_index(bool is_writing, bool reset) {
+  frame_index_loaded_ = true;
+  if (size_ < FRAME_INDEX_MIN_PAGE_SIZE) {
+    return;
+  }
+  auto capacity = (size_ - sizeof(page_header)) / sizeof(frame_header) / FRAME_INDEX_INTERVAL + 1;
+  auto size = capacity * sizeof(frame_index_entry);
+  frame_index_ = reinterpret_cast<frame_index_entry *>(load_sidecar("index", size, is_writing, false));
+  frame_index_capacity_ = frame_index_ == nullptr ? 0 : capacity;
+  if (frame_index_ != nullptr and reset) {
+    memset(frame_index_, 0, size);
+  }
+}
+
+void page::load_checksums(bool is_writing, bool reset) {
+  auto capacity = size_ / sizeof(frame_header);
+  checksums_ = reinterpret_cast<uint32_t *>(load_sidecar("sum", capacity * sizeof(uint32_t), is_writing, reset));
+  checksums_capacity_ = checksums_ == nullptr ? 0 : capacity;
+}
+
+uint32_t page::checksum(uintptr_t frame_address, uint32_t data_length) {
+  // length is left out as it is set last to publish the frame, data length is used as seed instead
+  auto begin = reinterpret_cast<const unsigned char *>(frame_address) + sizeof(frame_header::length);
+  auto length = static_cast<int32_t>(sizeof(frame_header) - sizeof(frame_header::length) + data_length);
+  return util::hash_32(begin, length, data_length) | 1u; // 0 stands for no checksum
+}
+
+bool page::is_valid_frame(uintptr_t frame_address) const {
+  if (frame_address < first_frame_address() or frame_address > address_border()) {
+    return false;
+  }
+  auto header = reinterpret_cast<const frame_header *>(frame_address);
+  uint32_t length = header->length;
+  if (header->header_length < sizeof(frame_header) or length < header->header_length or header->msg_type == 0 or
+      frame_address + length > address() + header_->page_size) {
+    return false;
+  }
+  auto slot = (frame_address - address()) / sizeof(frame_header);
+  auto sum = checksums_ != nullptr and slot < checksums_capacity_ ? checksums_[slot] : 0;
+  return sum == 0 or sum == checksum(frame_address, length - sizeof(frame_header));
+}
+
+void page::recover_tail() {
+  auto is_closed = [](uintptr_t frame_address) {
+    return reinterpret_cast<const frame_header *>(frame_address)->msg_type == PageEnd::tag;
+  };
+  auto length_of = [](uintptr_t frame_address) {
+    return reinterpret_cast<const frame_header *>(frame_address)->length;
+  };
+  uintptr_t last = last_frame_address();
+  if (not is_valid_frame(last)) {
+    // last published frame did not reach disk in one piece, find the valid one before it from the nearest sample
+    uintptr_t start = first_frame_address();
+    for (size_t i = 0; i < frame_index_capacity_ and frame_index_[i].offset != 0; i++) {
+      auto sample = address() + frame_index_[i].offset;
+      if (sample < last and is_valid_frame(sample)) {
+        start = sample;
+      }
+    }
+    last = 0;
+    for (auto frame_address = start; frame_address < last_frame_address() and is_valid_frame(frame_address);
+         frame_address += length_of(frame_address)) {
+      last = frame_address;
+    }
+  }
+  if (last != 0) {
+    // frames published right before crash may have not got last_frame_position updated
+    while (not is_closed(last) and is_valid_frame(last + length_of(last))) {
+      last += length_of(last);
+    }
+  }
+  if (last != 0 and is_closed(last)) {
+    set_last_frame_position(last - address());
+    return;
+  }
+  auto end = last == 0 ? first_frame_address() : last + length_of(last);
+  auto position = (last == 0 ? first_frame_address() : last) - address();
+  if (position != header_->last_frame_position) {
+    SPDLOG_WARN("recovered torn page {}/{:08x}.{}.journal, last frame position {} -> {}", location_->uname, dest_id_,
+                page_id_, header_->last_frame_position, position);
+  }
+  memset(reinterpret_cast<void *>(end), 0, sizeof(frame_header));
+  set_last_frame_position(position);
+  for (size_t i = 0; i < frame_index_capacity_; i++) {
+    if (frame_index_[i].offset >= end - address()) {
+      frame_index_[i].offset = 0;
+    }
+  }
+}
+
+page_verify_result page::verify(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id) {
+  auto target = load(location, dest_id, page_id, false, true);
+  target->load_checksums(false, false);
+  page_verify_result result = {0, target->first_frame_address() - target->address(), false, false};
+  auto frame_address = target->first_frame_address();
+  while (frame_address <= target->address_border() and reinterpret_cast<frame_header *>(frame_address)->length > 0) {
+    if (not target->is_valid_frame(frame_address)) {
+      result.torn = true;
+      break;
+    }
+    auto header = reinterpret_cast<const frame_header *>(frame_address);
+    result.frame_count++;
+    result.end_position = frame_address + header->length - target->address();
+    if (header->msg_type == PageEnd::tag) {
+      result.closed = true;
+      break;
+    }
+    frame_address += header->length;
+  }
+  return result;
+}
+
+std::pair<uint64_t, uintptr_t> page::seek_frame_index(int64_t time) {
+  if (not frame_index_loaded_) {
+    load_frame_index(false, false);
+  }
+  // samples form a contiguous run from the first frame, with max_gen_time in ascending order
+  auto begin = frame_index_;
+  auto end = frame_index_ + frame_index_capacity_;
+  auto found = std::partition_point(begin, end, [&](const frame_index_entry &entry) {
+    auto offset = entry.offset;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return offset != 0 and entry.max_gen_time <= time;
+  });
+  if (found > begin) {
+    auto offset = (found - 1)->offset;
+    if (offset >= header_->page_header_length and offset < address_border() - address()) {
+      return {(found - 1 - begin) * FRAME_INDEX_INTERVAL, address() + offset};
+    }
+  }
+  return {0, first_frame_address()};
 }
 
+void page::set_frame_checksum(bool enabled) { frame_checksum_enabled = enabled; }
+
+void page::set_mmap_hints(category category, uint32_t hints) { page_mmap_hints::of(category) = hints; }
+
+uint32_t page::get_mmap_hints(category category) { return page_mmap_hints::of(category); }
+
 std::string page::get_page_path(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id) {
   auto page_name = fmt::format("{:08x}.{}", dest_id, page_id);
   return location->locator->layout_file(location, longfist::enums::layout::JOURNAL, page_name);
 }
 
+std::string page::get_compressed_page_path(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id) {
+  auto dir = std::filesystem::path(location->locator->layout_dir(location, layout::JOURNAL));
+  return (dir / fmt::format("{:08x}.{}.zjournal", dest_id, page_id)).string();
+}
+
+bool page::exists(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id) {
+  return std::filesystem::exists(get_page_path(location, dest_id, page_id)) or
+         std::filesystem::exists(get_compressed_page_path(location, dest_id, page_id));
+}
+
+bool page::compress(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id) {
+  auto path = get_page_path(location, dest_id, page_id);
+  if (not std::filesystem::exists(path)) {
+    return false;
+  }
+  auto source = load(location, dest_id, page_id, false, true);
+  auto last_frame = reinterpret_cast<const frame_header *>(source->last_frame_address());
+  if (last_frame->msg_type != PageEnd::tag) {
+    return false;
+  }
+  auto data = reinterpret_cast<const uint8_t *>(source->address());
+  size_t data_length = source->last_frame_address() + last_frame->length - source->address();
+  uint32_t block_count = (data_length + COMPRESSED_BLOCK_SIZE - 1) / COMPRESSED_BLOCK_SIZE;
+  compressed_page_header header = {};
+  header.version = __JOURNAL_VERSION__;
+  header.page_size = source->get_page_size();
+  header.block_size = COMPRESSED_BLOCK_SIZE;
+  header.block_count = block_count;
+  header.begin_time = source->begin_time();
+  header.end_time = source->end_time();
+  std::vector<compressed_block> blocks(block_count);
+  std::vector<uint8_t> buffer(COMPRESSED_BLOCK_SIZE);
+
+  auto compressed_path = get_compressed_page_path(location, dest_id, page_id);
+  auto temp_path = compressed_path + ".tmp";
+  std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(blocks.data()), block_count * sizeof(compressed_block));
+  for (uint32_t i = 0; i < block_count; i++) {
+    auto offset = size_t(i) * COMPRESSED_BLOCK_SIZE;
+    auto length = std::min<size_t>(COMPRESSED_BLOCK_SIZE, data_length - offset);
+    auto compressed_length = util::lz_compress(data + offset, length, buffer.data(), length - 1);
+    bool shrunk = compressed_length > 0;
+    blocks[i] = {static_cast<uint32_t>(length), static_cast<uint32_t>(shrunk ? compressed_length : length)};
+    file.write(reinterpret_cast<const char *>(shrunk ? buffer.data() : data + offset), blocks[i].compressed_length);
+  }
+  file.seekp(sizeof(header));
+  file.write(reinterpret_cast<const char *>(blocks.data()), block_count * sizeof(compressed_block));
+  file.close();
+  if (not file.good()) {
+    std::filesystem::remove(temp_path);
+    throw journal_error("unable to write compressed page " + compressed_path);
+  }
+  std::filesystem::rename(temp_path, compressed_path);
+  std::error_code ec;
+  if (not std::filesystem::remove(path, ec)) {
+    SPDLOG_WARN("can not remove archived page {}: {}", path, ec.message());
+  }
+  return true;
+}
+
+uintptr_t page::load_compressed(const std::string &path, uint32_t page_size) {
+  std::ifstream file(path, std::ios::binary);
+  compressed_page_header header = {};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (not file.good() or header.version != __JOURNAL_VERSION__ or header.page_size != page_size) {
+    throw journal_error(fmt::format("{} is not a compressed page of version {} size {}", path, __JOURNAL_VERSION__,
+                                    page_size));
+  }
+  // counts and lengths come from the file, check them before they size anything
+  if (header.block_count > (page_size + COMPRESSED_BLOCK_SIZE - 1) / COMPRESSED_BLOCK_SIZE) {
+    throw journal_error(fmt::format("corrupted compressed page {}, {} blocks", path, header.block_count));
+  }
+  std::vector<compressed_block> blocks(header.block_count);
+  file.read(reinterpret_cast<char *>(blocks.data()), header.block_count * sizeof(compressed_block));
+  if (not file.good()) {
+    throw journal_error("truncated compressed page " + path);
+  }
+  auto address = os::alloc_mmap_buffer(page_size);
+  std::vector<uint8_t> buffer;
+  size_t offset = 0;
+  for (auto &block : blocks) {
+    auto dest = reinterpret_cast<uint8_t *>(address + offset);
+    bool valid = block.data_length <= COMPRESSED_BLOCK_SIZE and block.compressed_length <= block.data_length and
+                 offset + block.data_length <= page_size;
+    if (valid) {
+      buffer.resize(block.compressed_length);
+      file.read(reinterpret_cast<char *>(buffer.data()), block.compressed_length);
+      valid = file.good();
+    }
+    if (valid and block.compressed_length == block.data_length) {
+      memcpy(dest, buffer.data(), block.data_length);
+    } else if (valid) {
+      valid = util::lz_decompress(buffer.data(), buffer.size(), dest, block.data_length) == block.data_length;
+    }
+    if (not valid) {
+      os::release_mmap_buffer(address, page_size, true);
+      throw journal_error("corrupted compressed page " + path);
+    }
+    offset += block.data_length;
+  }
+  return address;
+}
+
+int64_t page::find_begin_time(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id) {
+  std::ifstream file(get_page_path(location, dest_id, page_id), std::ios::binary);
+  if (file.is_open()) {
+    page_header header = {};
+    frame_header first_frame = {};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    file.seekg(header.page_header_length);
+    file.read(reinterpret_cast<char *>(&first_frame), sizeof(first_frame));
+    return file.good() and first_frame.length > 0 ? first_frame.gen_time : 0;
+  }
+  std::ifstream compressed_file(get_compressed_page_path(location, dest_id, page_id), std::ios::binary);
+  compressed_page_header header = {};
+  compressed_file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  return compressed_file.good() ? header.begin_time : 0;
+}
+
 uint32_t page::find_page_id(const data::location_ptr &location, uint32_t dest_id, int64_t time) {
+  if (time != 0) {
+    auto page_id = find_page_id_by_index(location, dest_id, time);
+    if (page_id > 0) {
+      return page_id;
+    }
+  }
   std::vector<uint32_t> page_ids = location->locator->list_page_id(location, dest_id);
   if (page_ids.empty()) {
     return 1;
@@ -78,10 +480,83 @@ uint32_t page::find_page_id(const data::location_ptr &location, uint32_t dest_id
     return page_ids.front();
   }
   for (int i = static_cast<int>(page_ids.size()) - 1; i >= 0; i--) {
-    if (page::load(location, dest_id, page_ids[i], false, true)->begin_time() < time) {
+    auto begin_time = find_begin_time(location, dest_id, page_ids[i]);
+    // a page switched to right before the writer stops may have no frame, start from the page before it
+    if (begin_time < time and (i == 0 or begin_time > 0)) {
       return page_ids[i];
     }
   }
   return page_ids.front();
 }
+
+std::string page::get_page_index_path(const data::location_ptr &location, uint32_t dest_id) {
+  auto dir = std::filesystem::path(location->locator->layout_dir(location, layout::JOURNAL));
+  return (dir / fmt::format("{:08x}.index", dest_id)).string();
+}
+
+std::vector<page_index_entry> page::load_page_index(const data::location_ptr &location, uint32_t dest_id) {
+  std::vector<page_index_entry> entries = {};
+  std::ifstream file(get_page_index_path(location, dest_id), std::ios::binary | std::ios::ate);
+  if (not file.is_open()) {
+    return entries;
+  }
+  auto count = static_cast<size_t>(file.tellg()) / sizeof(page_index_entry); // ignore partially written tail
+  entries.resize(count);
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(entries.data()), count * sizeof(page_index_entry));
+  bool contiguous = file.good();
+  for (size_t i = 0; contiguous and i < count; i++) {
+    contiguous = entries[i].page_id == entries.front().page_id + i;
+  }
+  if (not contiguous) {
+    entries.clear();
+  }
+  return entries;
+}
+
+void page::trim_page_index(const data::location_ptr &location, uint32_t dest_id, uint32_t page_id) {
+  auto path = get_page_index_path(location, dest_id);
+  if (not std::filesystem::exists(path)) {
+    return;
+  }
+  auto entries = load_page_index(location, dest_id);
+  auto valid = std::find_if(entries.begin(), entries.end(), [&](auto &entry) { return entry.page_id >= page_id; });
+  auto size = std::distance(entries.begin(), valid) * sizeof(page_index_entry);
+  if (size != std::filesystem::file_size(path)) {
+    std::filesystem::resize_file(path, size);
+  }
+}
+
+void page::append_page_index() const {
+  page_index_entry entry = {page_id_, 0, begin_time(), end_time()};
+  std::ofstream file(get_page_index_path(location_, dest_id_), std::ios::binary | std::ios::app);
+  file.write(reinterpret_cast<const char *>(&entry), sizeof(page_index_entry));
+  if (not file.good()) {
+    SPDLOG_WARN("can not index page {}/{:08x}.{}.journal", location_->uname, dest_id_, page_id_);
+  }
+}
+
+uint32_t page::find_page_id_by_index(const data::location_ptr &location, uint32_t dest_id, int64_t time) {
+  auto entries = load_page_index(location, dest_id);
+  if (entries.empty()) {
+    return 0;
+  }
+  auto first_id = entries.front().page_id;
+  auto last_id = entries.back().page_id;
+  bool unindexed_before = first_id > 1 and exists(location, dest_id, first_id - 1);
+  if (unindexed_before or find_begin_time(location, dest_id, last_id + 2) > 0) {
+    return 0; // pages written without index
+  }
+  auto is_before = [&](const page_index_entry &entry) { return entry.begin_time < time; };
+  auto later = std::partition_point(entries.begin(), entries.end(), is_before);
+  auto current_begin_time = later == entries.end() ? find_begin_time(location, dest_id, last_id + 1) : 0;
+  if (current_begin_time > 0 and current_begin_time < time) {
+    return last_id + 1;
+  }
+  auto &entry = later == entries.begin() ? entries.front() : *(later - 1);
+  if (find_begin_time(location, dest_id, entry.page_id) != entry.begin_time) {
+    return 0; // index is stale
+  }
+  return entry.page_id;
+}
 } // namespace kungfu::yijinjing::journal
@@ -1,17 +1,41 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+
 #include <kungfu/yijinjing/journal/journal.h>
 #include <kungfu/yijinjing/journal/page.h>
 #include <kungfu/yijinjing/time.h>
 
 namespace kungfu::yijinjing::journal {
-reader::~reader() { journals_.clear(); }
+
+/**
+ * heap order for journals, the one holds the earliest frame goes to front,
+ * ties are broken by source/dest so that merge result does not depend on join order
+ */
+inline bool is_later(journal *a, journal *b) {
+  auto a_time = a->current_frame()->gen_time();
+  auto b_time = b->current_frame()->gen_time();
+  if (a_time != b_time) {
+    return a_time > b_time;
+  }
+  auto a_key = static_cast<uint64_t>(a->get_location()->uid) << 32u | static_cast<uint64_t>(a->get_dest());
+  auto b_key = static_cast<uint64_t>(b->get_location()->uid) << 32u | static_cast<uint64_t>(b->get_dest());
+  return a_key > b_key;
+}
+
+reader::~reader() {
+  heap_.clear();
+  idle_.clear();
+  journals_.clear();
+}
 
 void reader::join(const data::location_ptr &location, uint32_t dest_id, const int64_t from_time) {
   auto key = static_cast<uint64_t>(location->uid) << 32u | static_cast<uint64_t>(dest_id);
   auto result = journals_.try_emplace(key, location, dest_id, false, lazy_);
   if (result.second) {
-    journals_.at(key).seek_to_time(from_time);
+    auto &journal = result.first->second;
+    journal.seek_to_time(from_time);
+    idle_.push_back(&journal);
   }
   if (current_ == nullptr) {
     sort(); // do not sort if current_ is set (because we could be in process of reading)
@@ -27,6 +51,7 @@ void reader::disjoin(const uint32_t location_uid) {
     }
   }
   current_ = nullptr;
+  rebuild();
   sort();
 }
 
@@ -41,6 +66,7 @@ void reader::disjoin_channel(uint32_t location_uid, uint32_t dest_id) {
     }
   }
   current_ = nullptr;
+  rebuild();
   sort();
 }
 
@@ -53,25 +79,75 @@ void reader::seek_to_time(int64_t nanotime) {
   for (auto &pair : journals_) {
     pair.second.seek_to_time(nanotime);
   }
+  rebuild();
   sort();
 }
 
 void reader::next() {
   if (current_ != nullptr) {
-    current_->next();
+    if (not heap_.empty() and heap_.front() == current_) {
+      // only the journal we just read from moves, re-position it in O(log N)
+      std::pop_heap(heap_.begin(), heap_.end(), is_later);
+      heap_.pop_back();
+      current_->next();
+      push(current_);
+    } else {
+      current_->next();
+      rebuild();
+    }
   }
   sort();
 }
 
 void reader::sort() {
-  int64_t min_time = time::now_in_nano();
+  poll_idle();
+  if (heap_.empty()) {
+    return;
+  }
+  auto earliest = heap_.front();
+  auto gen_time = earliest->current_frame()->gen_time();
+  if (gen_time > now_) {
+    now_ = time::now_in_nano();
+  }
+  if (gen_time <= now_) {
+    current_ = earliest;
+  }
+}
+
+void reader::push(journal *j) {
+  if (j->current_frame()->has_data()) {
+    heap_.push_back(j);
+    std::push_heap(heap_.begin(), heap_.end(), is_later);
+  } else {
+    idle_.push_back(j);
+  }
+}
+
+void reader::poll_idle() {
+  for (size_t i = 0; i < idle_.size();) {
+    auto j = idle_[i];
+    if (j->current_frame()->has_data()) {
+      idle_[i] = idle_.back();
+      idle_.pop_back();
+      heap_.push_back(j);
+      std::push_heap(heap_.begin(), heap_.end(), is_later);
+    } else {
+      i++;
+    }
+  }
+}
+
+void reader::rebuild() {
+  heap_.clear();
+  idle_.clear();
   for (auto &pair : journals_) {
     auto &journal = pair.second;
-    auto &frame = journal.current_frame();
-    if (frame->has_data() && frame->gen_time() <= min_time) {
-      min_time = frame->gen_time();
-      current_ = &journal;
+    if (journal.current_frame()->has_data()) {
+      heap_.push_back(&journal);
+    } else {
+      idle_.push_back(&journal);
     }
   }
+  std::make_heap(heap_.begin(), heap_.end(), is_later);
 }
-} // namespace kungfu::yijinjing::journal
\ No newline at end of file
+} // namespace kungfu::yijinjing::journal
@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <thread>
+
 #include <kungfu/common.h>
 #include <kungfu/longfist/longfist.h>
 #include <kungfu/yijinjing/common.h>
@@ -10,31 +12,70 @@ using namespace longfist::types;
 
 constexpr uint32_t PAGE_ID_TRANC = 0xFFFF0000;
 constexpr uint32_t FRAME_ID_TRANC = 0x0000FFFF;
+constexpr uint64_t CURSOR_OFFSET_MASK = 0xFFFFFFFF;
+constexpr int64_t WRITER_WAIT_TIMEOUT = 30 * time_unit::NANOSECONDS_PER_SECOND;
+
+static std::atomic<uint64_t> writer_serial = 1;
 
-writer::writer(const data::location_ptr &location, uint32_t dest_id, bool lazy, publisher_ptr publisher)
+writer::writer(const data::location_ptr &location, uint32_t dest_id, bool lazy, publisher_ptr publisher,
+               bool multi_producer)
     : frame_id_base_(uint64_t(location->uid xor dest_id) << 32u), journal_(location, dest_id, true, lazy),
       publisher_(std::move(publisher)), size_to_write_(0),
-      writer_start_time_32int_(time::nano_hashed(time::now_in_nano())) {
-  journal_.seek_to_time(time::now_in_nano());
+      writer_start_time_32int_(time::nano_hashed(time::now_in_nano())), page_max_gen_time_(time::now_in_nano()),
+      multi_producer_(multi_producer), page_size_(find_page_size(location, dest_id)), serial_(writer_serial++) {
+  journal_.seek_to_time(page_max_gen_time_);
+  page::trim_page_index(location, dest_id, journal_.page_->get_page_id());
+  if (multi_producer_) {
+    // producers can not clear the header after their frames, which may have been reserved by others already,
+    // so the unwritten tail must start clean
+    auto tail = journal_.current_frame()->address();
+    memset(reinterpret_cast<void *>(tail), 0, journal_.page_->address() + journal_.page_->get_page_size() - tail);
+    auto offset = tail - journal_.page_->address();
+    reserve_cursor_ = uint64_t(journal_.page_->get_page_id()) << 32u | offset;
+    commit_position_ = offset;
+  }
+}
+
+const page_ptr writer::get_current_page() const {
+  if (multi_producer_) {
+    std::lock_guard<std::mutex> lock(page_mtx_);
+    return journal_.page_;
+  }
+  return journal_.page_;
 }
 
 uint64_t writer::current_frame_uid() {
   uint32_t page_part = (journal_.page_->page_id_ << 16u) & PAGE_ID_TRANC;
   uint32_t frame_part = journal_.page_frame_nb_ & FRAME_ID_TRANC;
+  if (multi_producer_) {
+    // frame number is not known until publish, use position of the reserved frame instead
+    auto &r = local_reservation();
+    page_part = (r.page_id << 16u) & PAGE_ID_TRANC;
+    frame_part = (r.offset / sizeof(frame_header)) & FRAME_ID_TRANC;
+  }
   // frame_id_base is used for get account id while canceling order
   return frame_id_base_ | ((page_part | frame_part) xor writer_start_time_32int_);
 }
 
 frame_ptr writer::open_frame(int64_t trigger_time, int32_t msg_type, uint32_t data_length) {
-  assert(sizeof(frame_header) + data_length + sizeof(frame_header) <= journal_.page_->get_page_size());
-  int64_t start_time = time::now_in_nano();
-  while (not writer_mtx_.try_lock()) {
-    if (time::now_in_nano() - start_time > 30 * time_unit::NANOSECONDS_PER_SECOND) {
-      throw journal_error("Can not lock writer for " + journal_.location_->uname);
-    }
+  assert(sizeof(frame_header) + data_length + sizeof(frame_header) <= page_size_);
+  if (multi_producer_) {
+    return reserve_frame(trigger_time, msg_type, data_length);
+  }
+  bool batching = in_batch();
+  if (not batching) {
+    lock_writer();
   }
   if (journal_.current_frame()->address() + sizeof(frame_header) + data_length >= journal_.page_->address_border()) {
-    close_page(trigger_time);
+    try {
+      flush_batch();
+      close_page(trigger_time);
+    } catch (...) {
+      if (not batching) {
+        writer_mtx_.unlock();
+      }
+      throw;
+    }
   }
   auto frame = journal_.current_frame();
   frame->set_header_length();
@@ -47,32 +88,73 @@ frame_ptr writer::open_frame(int64_t trigger_time, int32_t msg_type, uint32_t da
 }
 
 void writer::close_frame(size_t data_length, int64_t gen_time) {
+  if (multi_producer_) {
+    commit_frame(data_length, gen_time);
+    return;
+  }
   assert(size_to_write_ >= data_length);
   auto frame = journal_.current_frame();
+  if (in_batch()) {
+    frame->set_gen_time(gen_time);
+    journal_.page_->set_checksum(frame->address(), data_length);
+    if (batch_frame_address_ == 0) {
+      batch_frame_address_ = frame->address();
+      batch_data_length_ = data_length;
+    } else {
+      frame->set_data_length(data_length);
+    }
+    batch_last_frame_position_ = frame->address() - journal_.page_->address();
+    size_to_write_ = 0;
+    index_frame(frame);
+    // move on by hand, the first frame of batch has no length yet, the header after last frame is cleared on flush
+    frame->set_address(frame->address() + frame->header_length() + data_length);
+    journal_.page_frame_nb_++;
+    return;
+  }
   auto next_frame_address = frame->address() + frame->header_length() + data_length;
   assert(next_frame_address < journal_.page_->address_border());
   memset(reinterpret_cast<void *>(next_frame_address), 0, sizeof(frame_header));
   frame->set_gen_time(gen_time);
+  journal_.page_->set_checksum(frame->address(), data_length);
   frame->set_data_length(data_length);
   size_to_write_ = 0;
   journal_.page_->set_last_frame_position(frame->address() - journal_.page_->address());
+  index_frame(frame);
   journal_.next();
   writer_mtx_.unlock();
   publisher_->notify();
 }
 
 void writer::copy_frame(const frame_ptr &source) {
-  assert(source->frame_length() + sizeof(frame_header) <= journal_.page_->get_page_size());
+  assert(source->frame_length() + sizeof(frame_header) <= page_size_);
+  if (multi_producer_) {
+    auto frame = reserve_frame(source->trigger_time(), source->msg_type(), source->data_length());
+    memcpy(const_cast<void *>(frame->data_address()), source->data_address(), source->data_length());
+    frame->set_source(source->source());
+    frame->set_dest(source->dest());
+    commit_frame(source->data_length(), source->gen_time());
+    return;
+  }
+  // batch owner holds the lock already, its pending frames go out first to keep the order
+  std::unique_lock<std::mutex> lock(writer_mtx_, std::defer_lock);
+  if (in_batch()) {
+    flush_batch();
+  } else {
+    lock_writer();
+    lock = std::unique_lock<std::mutex>(writer_mtx_, std::adopt_lock);
+  }
   if (journal_.current_frame()->address() + source->frame_length() >= journal_.page_->address_border()) {
     close_page(yijinjing::time::now_in_nano());
   }
 
   auto frame = journal_.current_frame();
   frame->copy(*source);
+  journal_.page_->set_checksum(frame->address(), frame->data_length());
 
   auto next_frame_address = frame->address() + frame->header_length() + frame->data_length();
   memset(reinterpret_cast<void *>(next_frame_address), 0, sizeof(frame_header));
   journal_.page_->set_last_frame_position(frame->address() - journal_.page_->address());
+  index_frame(frame);
   journal_.next();
   publisher_->notify();
 }
@@ -100,7 +182,62 @@ void writer::mark(int64_t trigger_time, int32_t msg_type) {
   close_frame(length);
 }
 
-void writer::close_data() { close_frame(size_to_write_); }
+void writer::close_data() { close_frame(multi_producer_ ? local_reservation().data_length : size_to_write_); }
+
+void writer::begin_batch() {
+  if (multi_producer_ or in_batch()) {
+    return;
+  }
+  lock_writer();
+  batch_owner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+}
+
+void writer::end_batch() {
+  if (not in_batch()) {
+    return;
+  }
+  try {
+    flush_batch();
+  } catch (...) {
+    batch_owner_.store(std::thread::id(), std::memory_order_relaxed);
+    writer_mtx_.unlock();
+    throw;
+  }
+  batch_owner_.store(std::thread::id(), std::memory_order_relaxed);
+  writer_mtx_.unlock();
+  publisher_->notify();
+}
+
+bool writer::in_batch() const { return batch_owner_.load(std::memory_order_relaxed) == std::this_thread::get_id(); }
+
+void writer::lock_writer() {
+  int64_t start_time = time::now_in_nano();
+  while (not writer_mtx_.try_lock()) {
+    if (time::now_in_nano() - start_time > WRITER_WAIT_TIMEOUT) {
+      throw journal_error("Can not lock writer for " + journal_.location_->uname);
+    }
+  }
+}
+
+void writer::flush_batch() {
+  if (batch_frame_address_ == 0) {
+    return;
+  }
+  memset(reinterpret_cast<void *>(journal_.current_frame()->address()), 0, sizeof(frame_header));
+  std::atomic_thread_fence(std::memory_order_release);
+  frame first_frame;
+  first_frame.set_address(batch_frame_address_);
+  first_frame.set_data_length(batch_data_length_);
+  journal_.page_->set_last_frame_position(batch_last_frame_position_);
+  for (auto &sample : batch_index_samples_) {
+    journal_.page_->set_frame_index(sample.frame_nb, sample.frame_address, sample.max_gen_time);
+  }
+  batch_index_samples_.clear();
+  batch_frame_address_ = 0;
+  if (journal_.current_frame()->address() >= journal_.preload_address_) {
+    journal_.preload_next_page();
+  }
+}
 
 void writer::close_page(int64_t trigger_time) {
   page_ptr last_page = journal_.page_;
@@ -115,8 +252,123 @@ void writer::close_page(int64_t trigger_time) {
   last_page_frame.set_source(journal_.location_->uid);
   last_page_frame.set_dest(journal_.dest_id_);
   last_page_frame.set_gen_time(time::now_in_nano());
+  last_page->set_checksum(last_page_frame.address(), 0);
   last_page_frame.set_data_length(0);
   last_page->set_last_frame_position(last_page_frame.address() - last_page->address());
+  last_page->append_page_index();
+}
+
+void writer::index_frame(const frame_ptr &frame) {
+  auto gen_time = frame->gen_time();
+  auto frame_nb = journal_.page_frame_nb_;
+  page_max_gen_time_ = frame_nb == 0 ? gen_time : std::max(page_max_gen_time_, gen_time);
+  if (batch_frame_address_ != 0) {
+    if (frame_nb % FRAME_INDEX_INTERVAL == 0) {
+      batch_index_samples_.push_back({frame_nb, frame->address(), page_max_gen_time_});
+    }
+    return;
+  }
+  journal_.page_->set_frame_index(frame_nb, frame->address(), page_max_gen_time_);
+}
+
+writer::reservation &writer::local_reservation() {
+  // reservation of the writer this thread used last, lookup in the writer takes a lock
+  static thread_local std::pair<uint64_t, reservation *> cached = {0, nullptr};
+  if (cached.first == serial_) {
+    return *cached.second;
+  }
+  std::lock_guard<std::mutex> lock(reservations_mtx_);
+  auto &r = reservations_[std::this_thread::get_id()];
+  if (not r.frame) {
+    r.frame = std::shared_ptr<frame>(new frame());
+  }
+  cached = {serial_, &r};
+  return r;
+}
+
+frame_ptr writer::reserve_frame(int64_t trigger_time, int32_t msg_type, uint32_t data_length) {
+  auto &r = local_reservation();
+  auto frame_length = sizeof(frame_header) + data_length;
+  auto border = page_size_ - sizeof(frame_header);
+  while (true) {
+    auto cursor = reserve_cursor_.fetch_add(frame_length, std::memory_order_acq_rel);
+    auto page_id = static_cast<uint32_t>(cursor >> 32u);
+    auto offset = cursor & CURSOR_OFFSET_MASK;
+    if (offset + frame_length < border) {
+      r.page_id = page_id;
+      r.offset = offset;
+      r.data_length = data_length;
+      // page can not be switched before this frame gets published
+      r.frame->set_address(journal_.page_->address() + offset);
+      r.frame->set_header_length();
+      r.frame->set_trigger_time(trigger_time);
+      r.frame->set_msg_type(msg_type);
+      r.frame->set_source(journal_.location_->uid);
+      r.frame->set_dest(journal_.dest_id_);
+      return r.frame;
+    }
+    if (offset < border) {
+      roll_page(offset, trigger_time);
+      continue;
+    }
+    int64_t start_time = time::now_in_nano();
+    while (reserve_cursor_.load(std::memory_order_acquire) >> 32u == page_id) {
+      if (time::now_in_nano() - start_time > WRITER_WAIT_TIMEOUT) {
+        throw journal_error("Can not switch page for " + journal_.location_->uname);
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+void writer::commit_frame(size_t data_length, int64_t gen_time) {
+  auto &r = local_reservation();
+  auto &frame = r.frame;
+  assert(r.data_length >= data_length);
+  if (data_length < r.data_length) {
+    // frame still spans the reserved space to keep the next frame reachable, data moves to its end after padding
+    auto padding = r.data_length - data_length;
+    auto data = const_cast<char *>(frame->data_as_bytes());
+    memmove(data + padding, data, data_length);
+    memset(data, 0, padding);
+    frame->set_header_length(padding);
+  }
+  wait_for_commit(r.offset);
+  // gen_time was taken before waiting, a producer reserved earlier may come with a later one, readers rely on order
+  last_gen_time_ = std::max(last_gen_time_, gen_time);
+  frame->set_gen_time(last_gen_time_);
+  journal_.page_->set_checksum(frame->address(), r.data_length);
+  std::atomic_thread_fence(std::memory_order_release);
+  frame->set_data_length(data_length);
+  journal_.page_->set_last_frame_position(r.offset);
+  index_frame(frame);
+  journal_.next();
+  commit_position_.store(r.offset + frame->frame_length(), std::memory_order_release);
+  publisher_->notify();
+}
+
+void writer::roll_page(uint64_t offset, int64_t trigger_time) {
+  wait_for_commit(offset);
+  {
+    std::lock_guard<std::mutex> lock(page_mtx_);
+    close_page(trigger_time);
+  }
+  auto first_offset = journal_.current_frame()->address() - journal_.page_->address();
+  commit_position_.store(first_offset, std::memory_order_release);
+  reserve_cursor_.store(uint64_t(journal_.page_->get_page_id()) << 32u | first_offset, std::memory_order_release);
+}
+
+void writer::wait_for_commit(uint64_t offset) {
+  if (commit_position_.load(std::memory_order_acquire) == offset) {
+    return;
+  }
+  int64_t start_time = time::now_in_nano();
+  while (commit_position_.load(std::memory_order_acquire) != offset) {
+    if (time::now_in_nano() - start_time > WRITER_WAIT_TIMEOUT) {
+      throw journal_error("Can not publish frame for " + journal_.location_->uname);
+    }
+    std::this_thread::yield(); // the producer to wait for may be off cpu
+  }
 }
 
 } // namespace kungfu::yijinjing::journal
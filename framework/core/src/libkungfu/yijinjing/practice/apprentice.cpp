@@ -112,34 +112,15 @@ void apprentice::request_cached(uint32_t source_id) {
 }
 
 void apprentice::add_timer(int64_t nanotime, const std::function<void(const event_ptr &)> &callback) {
-  events_ | timer(nanotime) |
-      $([&, callback](const event_ptr &event) {
-        // try {
-        callback(event);
-        // } catch (const std::exception &e) {
-        //   SPDLOG_ERROR("Unexpected exception by timer {}", e.what());
-        // }
-      }
-        // [&](std::exception_ptr e) {
-        //   try {
-        //     std::rethrow_exception(e);
-        //   } catch (const rx::empty_error &ex) {
-        //     SPDLOG_WARN("{}", ex.what());
-        //   } catch (const std::exception &ex) {
-        //     SPDLOG_WARN("Unexpected exception by timer{}", ex.what());
-        //   }
-        // }
-      );
+  auto id = timer_usage_count_++;
+  request_time(id, nanotime - now());
+  local_timers_.schedule(id, nanotime, {id, 0, false, callback});
 }
 
 void apprentice::add_time_interval(int64_t duration, const std::function<void(const event_ptr &)> &callback) {
-  events_ | time_interval(std::chrono::nanoseconds(duration)) | $([&, callback](const event_ptr &event) {
-    // try {
-    callback(event);
-    // } catch (const std::exception &e) {
-    //   SPDLOG_ERROR("Unexpected exception by time_interval {}", e.what());
-    // }
-  });
+  auto id = timer_usage_count_++;
+  request_time(id, duration);
+  local_timers_.schedule(id, now() + duration, {id, duration, true, callback});
 }
 
 void apprentice::on_trading_day(const event_ptr &event, int64_t daytime) {}
@@ -159,6 +140,7 @@ void apprentice::react() {
   events_ | is(Band::tag) | $$(register_band(event->gen_time(), event->data<Band>()));
   events_ | is(TradingDay::tag) | $$(on_trading_day(event, event->data<TradingDay>().timestamp));
   events_ | is(RequestStop::tag) | to(get_home_uid()) | $$(signal_stop());
+  route(Time::tag, [&](const event_ptr &event) { on_time(event); });
   events_ | take_until(events_ | is(RequestStart::tag)) | $$(feed_state_data(event, state_bank_));
 
   SPDLOG_TRACE("building reactive event handlers");
@@ -312,6 +294,26 @@ void apprentice::expect_start() {
       );
 }
 
+void apprentice::request_time(int32_t id, int64_t duration) {
+  auto writer = get_writer(master_cmd_location_->uid);
+  TimeRequest &r = writer->open_data<TimeRequest>(0);
+  r.id = id;
+  r.duration = duration;
+  r.repeat = 1;
+  writer->close_data();
+}
+
+void apprentice::on_time(const event_ptr &event) {
+  // timers fire on the first Time event generated after their deadline
+  local_timers_.advance(event->gen_time() - 1, [&](uint64_t key, local_timer &timer) {
+    if (timer.repeat) {
+      request_time(timer.id, timer.duration);
+      local_timers_.schedule(key, now() + timer.duration, timer);
+    }
+    timer.callback(event);
+  });
+}
+
 void apprentice::reset_time(const longfist::types::TimeReset &time_reset) {
   time::reset(time_reset.system_clock_count, time_reset.steady_clock_count);
 }
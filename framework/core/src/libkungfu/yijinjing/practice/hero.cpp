@@ -348,7 +348,9 @@ bool hero::drain(const rx::subscriber<event_ptr> &sb) {
     const std::string &notice = io_device_->get_observer()->get_notice();
     now_ = time::now_in_nano();
     if (notice.length() > 2) {
-      sb.on_next(std::make_shared<nanomsg_json>(notice));
+      event_ptr event = std::make_shared<nanomsg_json>(notice);
+      sb.on_next(event);
+      route_event(event);
     } else {
       on_notify();
     }
@@ -359,7 +361,9 @@ bool hero::drain(const rx::subscriber<event_ptr> &sb) {
       if (frame_time > now_) {
         now_ = frame_time;
       }
-      sb.on_next(reader_->current_frame());
+      event_ptr event = reader_->current_frame();
+      sb.on_next(event);
+      route_event(event);
       on_frame();
       reader_->next();
     } else {
@@ -374,6 +378,66 @@ bool hero::drain(const rx::subscriber<event_ptr> &sb) {
   return true;
 }
 
+uint64_t hero::route(int32_t msg_type, uint32_t source, uint32_t dest, EventHandler handler) {
+  event_route route = {++last_route_id_, source, dest, std::move(handler)};
+  if (routing_) {
+    pending_routes_.emplace_back(msg_type, std::move(route));
+  } else {
+    routes_[msg_type].push_back(std::move(route));
+  }
+  return last_route_id_;
+}
+
+void hero::unroute(uint64_t route_id) {
+  if (routing_) {
+    pending_unroutes_.push_back(route_id);
+    return;
+  }
+  auto routes_it = routes_.begin();
+  while (routes_it != routes_.end()) {
+    auto &routes = routes_it->second;
+    routes.erase(std::remove_if(routes.begin(), routes.end(), [&](auto &route) { return route.id == route_id; }),
+                 routes.end());
+    routes_it = routes.empty() ? routes_.erase(routes_it) : std::next(routes_it);
+  }
+}
+
+void hero::route_event(const event_ptr &event) {
+  if (routes_.empty()) {
+    return;
+  }
+  auto routes_it = routes_.find(event->msg_type());
+  if (routes_it == routes_.end()) {
+    return;
+  }
+  routing_ = true;
+  try {
+    for (const auto &route : routes_it->second) {
+      bool source_match = route.source == ROUTE_ANY or route.source == event->source();
+      bool dest_match = route.dest == ROUTE_ANY or route.dest == event->dest();
+      if (source_match and dest_match) {
+        route.handler(event);
+      }
+    }
+  } catch (...) {
+    apply_pending_routes();
+    throw;
+  }
+  apply_pending_routes();
+}
+
+void hero::apply_pending_routes() {
+  routing_ = false;
+  for (auto &[msg_type, route] : pending_routes_) {
+    routes_[msg_type].push_back(std::move(route));
+  }
+  pending_routes_.clear();
+  for (auto route_id : pending_unroutes_) {
+    unroute(route_id);
+  }
+  pending_unroutes_.clear();
+}
+
 void hero::delegate_produce(hero *instance, const rx::subscriber<event_ptr> &subscriber) {
 #ifdef _WINDOWS
   __try {
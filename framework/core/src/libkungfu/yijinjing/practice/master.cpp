@@ -154,7 +154,7 @@ void master::register_app(const event_ptr &event) {
   registry_.erase(app_location_uid);
   reader_->disjoin(app_location_uid);
   writers_.erase(app_location_uid);
-  timer_tasks_.erase(app_location_uid);
+  timer_tasks_.cancel_if([&](uint64_t key, const timer_task &) { return key >> 32u == app_location_uid; });
   get_writer(location::PUBLIC)->write(trigger_time, location->to<Deregister>());
 }
 
@@ -199,24 +199,14 @@ void master::on_active() {
 void master::on_frame() { handle_timer_tasks(); }
 
 void master::handle_timer_tasks() {
-  auto now = time::now_in_nano();
-  for (auto &app : timer_tasks_) {
-    uint32_t app_id = app.first;
-    auto &app_tasks = app.second;
-    for (auto it = app_tasks.begin(); it != app_tasks.end();) {
-      auto &task = it->second;
-      if (task.checkpoint <= now) {
-        get_writer(app_id)->mark(0, Time::tag);
-        task.checkpoint += task.duration;
-        task.repeat_count++;
-        if (task.repeat_count >= task.repeat_limit) {
-          it = app_tasks.erase(it);
-          continue;
-        }
-      }
-      it++;
+  timer_tasks_.advance(time::now_in_nano(), [&](uint64_t key, timer_task &task) {
+    get_writer(key >> 32u)->mark(0, Time::tag);
+    task.checkpoint += task.duration;
+    task.repeat_count++;
+    if (task.repeat_count < task.repeat_limit) {
+      timer_tasks_.schedule(key, task.checkpoint, task);
     }
-  }
+  });
 }
 
 void master::try_add_location(int64_t trigger_time, const location_ptr &app_location) {
@@ -353,14 +343,13 @@ void master::on_channel_request(const event_ptr &event) {
 
 void master::on_time_request(const event_ptr &event) {
   const TimeRequest &request = event->data<TimeRequest>();
-  timer_tasks_.try_emplace(event->source());
-  auto &app_tasks = timer_tasks_.at(event->source());
-  app_tasks.try_emplace(request.id);
-  auto &task = app_tasks.at(request.id);
+  timer_task task = {};
   task.checkpoint = time::now_in_nano() + request.duration;
   task.duration = request.duration;
   task.repeat_count = 0;
   task.repeat_limit = request.repeat;
+  uint64_t key = uint64_t(event->source()) << 32u | uint32_t(request.id);
+  timer_tasks_.schedule(key, task.checkpoint, task);
 }
 
 void master::on_new_location(const event_ptr &event) {
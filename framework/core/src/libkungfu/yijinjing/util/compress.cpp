@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <kungfu/yijinjing/util/util.h>
+
+namespace kungfu::yijinjing::util {
+
+// each sequence is a token byte (literal length in high 4 bits, match length - MIN_MATCH in low 4 bits),
+// literal length overflow bytes, literals, then 2 bytes little endian match offset and match length overflow bytes,
+// the last sequence has literals only
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 8;
+constexpr size_t MAX_OFFSET = 0xFFFF;
+constexpr uint32_t HASH_BITS = 16;
+constexpr uint8_t RUN_MASK = 0xF;
+
+static inline uint32_t read_32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t hash_sequence(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - HASH_BITS); }
+
+static inline bool write_length(uint8_t *dest, size_t capacity, size_t &op, size_t length) {
+  for (; length >= 0xFF; length -= 0xFF) {
+    if (op >= capacity) {
+      return false;
+    }
+    dest[op++] = 0xFF;
+  }
+  if (op >= capacity) {
+    return false;
+  }
+  dest[op++] = static_cast<uint8_t>(length);
+  return true;
+}
+
+static inline bool read_length(const uint8_t *source, size_t length, size_t &ip, size_t &value) {
+  uint8_t byte;
+  do {
+    if (ip >= length) {
+      return false;
+    }
+    byte = source[ip++];
+    value += byte;
+  } while (byte == 0xFF);
+  return true;
+}
+
+static bool write_sequence(uint8_t *dest, size_t capacity, size_t &op, const uint8_t *literals, size_t literal_length,
+                           size_t offset, size_t match_length) {
+  if (op >= capacity) {
+    return false;
+  }
+  auto &token = dest[op++];
+  token = static_cast<uint8_t>(std::min<size_t>(literal_length, RUN_MASK) << 4u);
+  if (literal_length >= RUN_MASK and not write_length(dest, capacity, op, literal_length - RUN_MASK)) {
+    return false;
+  }
+  if (op + literal_length > capacity) {
+    return false;
+  }
+  memcpy(dest + op, literals, literal_length);
+  op += literal_length;
+  if (match_length == 0) {
+    return true;
+  }
+  if (op + 2 > capacity) {
+    return false;
+  }
+  dest[op++] = static_cast<uint8_t>(offset);
+  dest[op++] = static_cast<uint8_t>(offset >> 8u);
+  auto extra = match_length - MIN_MATCH;
+  token |= static_cast<uint8_t>(std::min<size_t>(extra, RUN_MASK));
+  return extra < RUN_MASK or write_length(dest, capacity, op, extra - RUN_MASK);
+}
+
+size_t lz_compress(const uint8_t *source, size_t length, uint8_t *dest, size_t capacity) {
+  std::vector<uint32_t> table(1u << HASH_BITS, 0); // position + 1 of last sequence with the hash, 0 for none
+  size_t ip = 0;
+  size_t op = 0;
+  size_t anchor = 0;
+  size_t limit = length > LAST_LITERALS + MIN_MATCH ? length - LAST_LITERALS - MIN_MATCH : 0;
+  while (ip < limit) {
+    auto sequence = read_32(source + ip);
+    auto &slot = table[hash_sequence(sequence)];
+    size_t ref = slot;
+    slot = static_cast<uint32_t>(ip + 1);
+    if (ref == 0 or ip + 1 - ref > MAX_OFFSET or read_32(source + ref - 1) != sequence) {
+      ip++;
+      continue;
+    }
+    ref--;
+    size_t match_length = MIN_MATCH;
+    while (ip + match_length < length - LAST_LITERALS and source[ref + match_length] == source[ip + match_length]) {
+      match_length++;
+    }
+    if (not write_sequence(dest, capacity, op, source + anchor, ip - anchor, ip - ref, match_length)) {
+      return 0;
+    }
+    ip += match_length;
+    anchor = ip;
+  }
+  if (not write_sequence(dest, capacity, op, source + anchor, length - anchor, 0, 0)) {
+    return 0;
+  }
+  return op;
+}
+
+size_t lz_decompress(const uint8_t *source, size_t length, uint8_t *dest, size_t capacity) {
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < length) {
+    uint8_t token = source[ip++];
+    size_t literal_length = token >> 4u;
+    if (literal_length == RUN_MASK and not read_length(source, length, ip, literal_length)) {
+      return 0;
+    }
+    if (ip + literal_length > length or op + literal_length > capacity) {
+      return 0;
+    }
+    memcpy(dest + op, source + ip, literal_length);
+    ip += literal_length;
+    op += literal_length;
+    if (ip == length) {
+      break;
+    }
+    if (ip + 2 > length) {
+      return 0;
+    }
+    size_t offset = source[ip] | (source[ip + 1] << 8u);
+    ip += 2;
+    size_t match_length = token & RUN_MASK;
+    if (match_length == RUN_MASK and not read_length(source, length, ip, match_length)) {
+      return 0;
+    }
+    match_length += MIN_MATCH;
+    if (offset == 0 or offset > op or op + match_length > capacity) {
+      return 0;
+    }
+    if (offset >= match_length) {
+      memcpy(dest + op, dest + op - offset, match_length);
+      op += match_length;
+    } else {
+      for (size_t i = 0; i < match_length; i++, op++) {
+        dest[op] = dest[op - offset];
+      }
+    }
+  }
+  return op;
+}
+} // namespace kungfu::yijinjing::util
@@ -8,10 +8,25 @@
 #include <kungfu/yijinjing/log.h>
 #include <kungfu/yijinjing/time.h>
 
+#include <atomic>
+#include <thread>
+
 #include <spdlog/sinks/daily_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 namespace kungfu::yijinjing::log {
+/**
+ * record time of logs by yijinjing clock, so that they line up with journal
+ */
+static spdlog::log_clock::time_point from_nano(int64_t nanotime) {
+  return spdlog::log_clock::time_point(std::chrono::duration_cast<spdlog::log_clock::duration>(
+      std::chrono::nanoseconds(nanotime)));
+}
+
+static int64_t to_nano(spdlog::log_clock::time_point time_point) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count();
+}
+
 class pattern_formatter : public spdlog::formatter {
 public:
   pattern_formatter() : spdlog_formatter(LOG_PATTERN) {}
@@ -24,7 +39,9 @@ public:
   }
 
   void format(const spdlog::details::log_msg &msg, spdlog::memory_buf_t &dest) override {
-    spdlog::details::fmt_helper::append_string_view(time::strftime(time::now_in_nano(), TS_PATTERN), dest);
+    char timestamp[64];
+    auto length = time::strftime(timestamp, sizeof(timestamp), to_nano(msg.time), TS_PATTERN);
+    spdlog::details::fmt_helper::append_string_view(spdlog::string_view_t(timestamp, length), dest);
     spdlog_formatter.format(msg, dest);
   }
 
@@ -32,6 +49,188 @@ private:
   spdlog::pattern_formatter spdlog_formatter;
 };
 
+class emitable_logger;
+
+/**
+ * single producer single consumer byte ring owned by one logging thread, holds log records packed back to back
+ */
+class async_log_ring {
+public:
+  static constexpr size_t CAPACITY = 1 << 20;
+
+  struct record {
+    /** total size including header and strings, 8-byte aligned */
+    uint32_t size;
+    /** filler up to end of buffer, no log in it */
+    uint32_t skip;
+    int64_t time;
+    size_t thread_id;
+    int32_t level;
+    int32_t source_line;
+    uint32_t filename_length;
+    uint32_t funcname_length;
+    uint32_t logger_name_length;
+    uint32_t payload_length;
+  };
+
+  std::atomic<bool> closed = false;
+
+  /**
+   * copy log into ring, waits for consumer if ring is full, logs too large for the ring get truncated
+   */
+  void push(const spdlog::details::log_msg &msg, int64_t time) {
+    auto filename = msg.source.filename == nullptr ? "" : msg.source.filename;
+    auto funcname = msg.source.funcname == nullptr ? "" : msg.source.funcname;
+    record header = {};
+    header.time = time;
+    header.thread_id = msg.thread_id;
+    header.level = msg.level;
+    header.source_line = msg.source.line;
+    header.filename_length = strlen(filename);
+    header.funcname_length = strlen(funcname);
+    header.logger_name_length = msg.logger_name.size();
+    auto fixed_size = sizeof(record) + header.filename_length + header.funcname_length + header.logger_name_length + 2;
+    header.payload_length = std::min(msg.payload.size(), CAPACITY / 2 - fixed_size);
+    header.size = align(fixed_size + header.payload_length);
+
+    auto address = reserve(header.size);
+    memcpy(address, &header, sizeof(header));
+    auto cursor = address + sizeof(header);
+    cursor = append(cursor, filename, header.filename_length + 1);
+    cursor = append(cursor, funcname, header.funcname_length + 1);
+    cursor = append(cursor, msg.logger_name.data(), header.logger_name_length);
+    append(cursor, msg.payload.data(), header.payload_length);
+    head_.store(head_.load(std::memory_order_relaxed) + header.size, std::memory_order_release);
+  }
+
+  /** next record to consume, nullptr if empty */
+  const record *front() {
+    while (true) {
+      auto tail = tail_.load(std::memory_order_relaxed);
+      if (tail == head_.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+      auto front = reinterpret_cast<const record *>(buffer_.data() + tail % CAPACITY);
+      if (not front->skip) {
+        return front;
+      }
+      tail_.store(tail + front->size, std::memory_order_release);
+    }
+  }
+
+  void pop() {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto front = reinterpret_cast<const record *>(buffer_.data() + tail % CAPACITY);
+    tail_.store(tail + front->size, std::memory_order_release);
+  }
+
+  static spdlog::details::log_msg to_log_msg(const record *r) {
+    auto filename = reinterpret_cast<const char *>(r) + sizeof(record);
+    auto funcname = filename + r->filename_length + 1;
+    auto logger_name = funcname + r->funcname_length + 1;
+    auto payload = logger_name + r->logger_name_length;
+    spdlog::source_loc source(filename, r->source_line, funcname);
+    spdlog::details::log_msg msg(from_nano(r->time), source, spdlog::string_view_t(logger_name, r->logger_name_length),
+                                 static_cast<spdlog::level::level_enum>(r->level),
+                                 spdlog::string_view_t(payload, r->payload_length));
+    msg.thread_id = r->thread_id;
+    return msg;
+  }
+
+private:
+  std::vector<char> buffer_ = std::vector<char>(CAPACITY);
+  std::atomic<uint64_t> head_ = 0;
+  std::atomic<uint64_t> tail_ = 0;
+
+  static uint32_t align(size_t size) { return (size + 7u) & ~size_t(7u); }
+
+  static char *append(char *cursor, const char *data, size_t length) {
+    memcpy(cursor, data, length);
+    return cursor + length;
+  }
+
+  /** contiguous space for size bytes, records never wrap around, the rest of buffer is skipped instead */
+  char *reserve(uint32_t size) {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto room_to_end = CAPACITY - head % CAPACITY;
+    if (room_to_end < size) {
+      wait_for_space(room_to_end);
+      auto filler = reinterpret_cast<record *>(buffer_.data() + head % CAPACITY);
+      filler->size = room_to_end;
+      filler->skip = 1;
+      head_.store(head += room_to_end, std::memory_order_release);
+    }
+    wait_for_space(size);
+    return buffer_.data() + head % CAPACITY;
+  }
+
+  void wait_for_space(size_t size) {
+    while (head_.load(std::memory_order_relaxed) + size - tail_.load(std::memory_order_acquire) > CAPACITY) {
+      std::this_thread::yield();
+    }
+  }
+};
+
+/**
+ * formats and writes logs on a background thread, logging threads only copy their logs into their own rings
+ */
+class async_log_backend {
+public:
+  explicit async_log_backend(std::shared_ptr<emitable_logger> target)
+      : target_(std::move(target)), thread_([this] { run(); }) {}
+
+  ~async_log_backend() {
+    live_ = false;
+    thread_.join();
+  }
+
+  void push(const spdlog::details::log_msg &msg, int64_t time) { local_ring().push(msg, time); }
+
+  /** wait for logs pushed so far to be written */
+  void drain() {
+    auto pushed = pushed_.fetch_add(1) + 1;
+    while (written_.load() < pushed and live_) {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  static constexpr auto IDLE_INTERVAL = std::chrono::microseconds(200);
+
+  std::shared_ptr<emitable_logger> target_;
+  std::mutex rings_mutex_ = {};
+  std::vector<std::shared_ptr<async_log_ring>> rings_ = {};
+  std::atomic<bool> live_ = true;
+  /** drain requests, each answered by a full pass over all rings */
+  std::atomic<uint64_t> pushed_ = 0;
+  std::atomic<uint64_t> written_ = 0;
+  std::thread thread_;
+
+  async_log_ring &local_ring() {
+    struct ring_holder {
+      std::shared_ptr<async_log_ring> ring;
+      ~ring_holder() {
+        if (ring) {
+          ring->closed = true;
+        }
+      }
+    };
+    static thread_local std::unordered_map<async_log_backend *, ring_holder> holders;
+    auto &holder = holders[this];
+    if (not holder.ring) {
+      holder.ring = std::make_shared<async_log_ring>();
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      rings_.push_back(holder.ring);
+    }
+    return *holder.ring;
+  }
+
+  void run();
+
+  /** write everything in rings, the earliest record of all rings goes first */
+  bool write_all();
+};
+
 class emitable_logger : public spdlog::logger {
 public:
   emitable_logger(std::string name, spdlog::sink_ptr single_sink)
@@ -53,8 +252,87 @@ public:
     spdlog::details::log_msg record(source_loc, logger_name, static_cast<spdlog::level::level_enum>(log_level), msg);
     sink_it_(record);
   }
+
+  /**
+   * hand logs over to background thread instead of writing them inline
+   */
+  void set_async_backend(std::shared_ptr<async_log_backend> backend) { async_backend_ = std::move(backend); }
+
+  /** called by async backend thread, errors go to the error handler as those of sinks do */
+  void write(const spdlog::details::log_msg &msg) {
+    try {
+      spdlog::logger::sink_it_(msg);
+    } catch (const std::exception &ex) {
+      err_handler_(ex.what());
+    }
+  }
+
+protected:
+  void sink_it_(const spdlog::details::log_msg &msg) override {
+    auto now = time::now_in_nano();
+    if (async_backend_) {
+      async_backend_->push(msg, now);
+    } else {
+      spdlog::details::log_msg record(msg);
+      record.time = from_nano(now);
+      spdlog::logger::sink_it_(record);
+    }
+  }
+
+  void flush_() override {
+    if (async_backend_) {
+      async_backend_->drain();
+    }
+    spdlog::logger::flush_();
+  }
+
+private:
+  std::shared_ptr<async_log_backend> async_backend_ = {};
 };
 
+void async_log_backend::run() {
+  while (live_) {
+    auto requested = pushed_.load();
+    auto busy = write_all();
+    written_ = requested;
+    if (not busy) {
+      std::this_thread::sleep_for(IDLE_INTERVAL);
+    }
+  }
+  write_all();
+  written_ = pushed_.load();
+}
+
+bool async_log_backend::write_all() {
+  std::vector<std::shared_ptr<async_log_ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    // rings of exited threads are dropped once they are consumed
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+                                [](auto &ring) { return ring->closed and ring->front() == nullptr; }),
+                 rings_.end());
+    rings = rings_;
+  }
+  bool written = false;
+  while (true) {
+    async_log_ring *earliest = nullptr;
+    const async_log_ring::record *earliest_record = nullptr;
+    for (auto &ring : rings) {
+      auto front = ring->front();
+      if (front != nullptr and (earliest_record == nullptr or front->time < earliest_record->time)) {
+        earliest = ring.get();
+        earliest_record = front;
+      }
+    }
+    if (earliest == nullptr) {
+      return written;
+    }
+    target_->write(async_log_ring::to_log_msg(earliest_record));
+    earliest->pop();
+    written = true;
+  }
+}
+
 spdlog::level::level_enum get_env_log_level(const data::locator_ptr &locator) {
   auto level_name = locator->has_env(LOG_LEVEL_ENV) ? locator->get_env(LOG_LEVEL_ENV) : DEFAULT_LOG_LEVEL_NAME;
   return spdlog::level::from_str(level_name);
@@ -80,6 +358,14 @@ const std::string &setup_log(const data::location_ptr &location, const std::stri
     logger->set_level(get_env_log_level(location->locator));
     logger->flush_on(spdlog::level::trace);
 
+    auto locator = location->locator;
+    if (locator->has_env(LOG_ASYNC_ENV) and std::atoi(locator->get_env(LOG_ASYNC_ENV).c_str()) > 0) {
+      // logger kept by backend writes what the default logger hands over
+      auto async_logger = std::make_shared<emitable_logger>(*logger);
+      async_logger->set_async_backend(std::make_shared<async_log_backend>(logger));
+      logger = async_logger;
+    }
+
     spdlog::set_default_logger(std::static_pointer_cast<spdlog::logger>(logger));
   } else {
     SPDLOG_WARN("Setup log for {} more than once", name);
@@ -14,8 +14,16 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef __linux__
+#include <linux/magic.h>
+#include <sys/vfs.h>
+#endif // __linux__
+
 #endif // _WINDOWS
 
+#include <cerrno>
+#include <cstring>
+
 #include <kungfu/common.h>
 #include <kungfu/yijinjing/journal/common.h>
 #include <kungfu/yijinjing/util/os.h>
@@ -24,7 +32,50 @@ using namespace kungfu::yijinjing::journal;
 
 namespace kungfu::yijinjing::os {
 
-uintptr_t load_mmap_buffer(const std::string &path, size_t size, bool is_writing, bool lazy) {
+#ifdef __linux__
+constexpr uintptr_t HUGE_PAGE_SIZE = 2 * MB;
+
+/**
+ * map file at an address aligned to huge page size, so that THP/hugetlbfs can back the whole range,
+ * returns MAP_FAILED if it can not be done
+ */
+static void *mmap_huge_page_aligned(size_t size, int prot, int flags, int fd) {
+  // mapping on hugetlbfs covers whole huge pages, reserve room for that
+  size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  size_t span = huge_size + HUGE_PAGE_SIZE;
+  void *reserved = mmap(nullptr, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  auto begin = reinterpret_cast<uintptr_t>(reserved);
+  auto end = begin + span;
+  auto aligned = (begin + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  void *buffer = mmap(reinterpret_cast<void *>(aligned), size, prot, flags | MAP_FIXED, fd, 0);
+  if (buffer == MAP_FAILED) {
+    munmap(reserved, span);
+    return MAP_FAILED;
+  }
+  if (aligned > begin) {
+    munmap(reserved, aligned - begin);
+  }
+  if (munmap(reinterpret_cast<void *>(aligned + size), end - aligned - size) != 0 and end > aligned + huge_size) {
+    munmap(reinterpret_cast<void *>(aligned + huge_size), end - aligned - huge_size);
+  }
+  madvise(buffer, size, MADV_HUGEPAGE); // best effort, fails when THP is disabled
+  return buffer;
+}
+
+/**
+ * huge page size of the hugetlbfs file is on, 0 if it is not on hugetlbfs
+ */
+static size_t hugetlbfs_page_size(int fd) {
+  struct statfs fs_stat = {};
+  return fstatfs(fd, &fs_stat) == 0 and fs_stat.f_type == HUGETLBFS_MAGIC ? fs_stat.f_bsize : 0;
+}
+#endif // __linux__
+
+uintptr_t load_mmap_buffer(const std::string &path, size_t size, bool is_writing, bool lazy,
+                           [[maybe_unused]] uint32_t hints) {
 #ifdef _WINDOWS
   bool master = is_writing || !lazy;
   HANDLE dumpFileDescriptor = CreateFileA(path.c_str(), (master) ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
@@ -59,7 +110,25 @@ uintptr_t load_mmap_buffer(const std::string &path, size_t size, bool is_writing
     throw journal_error("failed to open file for page " + path);
   }
 
-  if (master) {
+#ifdef __linux__
+  bool huge_pages = hints & MMAP_HUGE_PAGES;
+  size_t huge_page_size = huge_pages ? hugetlbfs_page_size(fd) : 0;
+#else
+  size_t huge_page_size = 0;
+#endif // __linux__
+
+  bool stretched = false;
+  if (master and huge_page_size > 0) {
+    // hugetlbfs does not support write(2), stretch by ftruncate instead, to whole huge pages or it fails with EINVAL
+    size_t file_size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+    struct stat file_stat = {};
+    stretched = fstat(fd, &file_stat) == 0 and
+                (static_cast<size_t>(file_stat.st_size) >= file_size or ftruncate(fd, file_size) == 0);
+    if (not stretched) {
+      SPDLOG_WARN("failed to stretch {} on hugetlbfs: {}, fallback to normal mapping", path, strerror(errno));
+    }
+  }
+  if (master and not stretched) {
     if (lseek(fd, size - 1, SEEK_SET) == -1) {
       close(fd);
       throw journal_error("failed to stretch for page " + path);
@@ -77,7 +146,23 @@ uintptr_t load_mmap_buffer(const std::string &path, size_t size, bool is_writing
    * races where it might get reassigned to something else if you first released the old resource then attempted to
    * regain it for the new resource.
    */
-  void *buffer = mmap(0, size, master ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+  int prot = master ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  int flags = MAP_SHARED;
+  void *buffer = MAP_FAILED;
+#ifdef __linux__
+  if (hints & MMAP_POPULATE) {
+    flags |= MAP_POPULATE;
+  }
+  if (huge_pages) {
+    buffer = mmap_huge_page_aligned(size, prot, flags, fd);
+    if (buffer == MAP_FAILED) {
+      SPDLOG_DEBUG("huge page mapping not available for {}, fallback to normal pages", path);
+    }
+  }
+#endif // __linux__
+  if (buffer == MAP_FAILED) {
+    buffer = mmap(0, size, prot, flags, fd, 0);
+  }
 
   if (buffer == MAP_FAILED) {
     close(fd);
@@ -96,6 +181,28 @@ uintptr_t load_mmap_buffer(const std::string &path, size_t size, bool is_writing
   return reinterpret_cast<uintptr_t>(buffer);
 }
 
+uintptr_t alloc_mmap_buffer(size_t size) {
+#ifdef _WINDOWS
+  auto high = static_cast<DWORD>(uint64_t(size) >> 32u);
+  auto low = static_cast<DWORD>(size & 0xFFFFFFFF);
+  HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, high, low, NULL);
+  if (mapping == NULL) {
+    throw journal_error("unable to allocate mmap buffer, CreateFileMapping Error " + std::to_string(GetLastError()));
+  }
+  void *buffer = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  CloseHandle(mapping);
+  if (buffer == nullptr) {
+    throw journal_error("unable to allocate mmap buffer, MapViewOfFile Error " + std::to_string(GetLastError()));
+  }
+#else
+  void *buffer = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) {
+    throw journal_error("unable to allocate mmap buffer");
+  }
+#endif // _WINDOWS
+  return reinterpret_cast<uintptr_t>(buffer);
+}
+
 bool release_mmap_buffer(uintptr_t address, [[maybe_unused]] size_t size, bool lazy) {
   void *buffer = reinterpret_cast<void *>(address);
 #ifdef _WINDOWS
@@ -108,10 +215,33 @@ bool release_mmap_buffer(uintptr_t address, [[maybe_unused]] size_t size, bool l
   }
 
   if (munmap(buffer, size) != 0) {
+#ifdef __linux__
+    // pages on hugetlbfs are mapped in whole huge pages, and can only be unmapped that way
+    auto huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    return errno == EINVAL and huge_size != size and munmap(buffer, huge_size) == 0;
+#else
     return false;
+#endif // __linux__
   }
 #endif // _WINDOWS
   return true;
 }
 
+void prefault_mmap_buffer(uintptr_t address, size_t size, bool is_writing) {
+#ifdef _WINDOWS
+  size_t step = 4 * KB;
+#else
+  auto step = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  madvise(reinterpret_cast<void *>(address), size, MADV_WILLNEED);
+#endif // _WINDOWS
+  for (size_t offset = 0; offset < size; offset += step) {
+    auto byte = reinterpret_cast<volatile uint8_t *>(address + offset);
+    if (is_writing) {
+      *byte = *byte;
+    } else {
+      [[maybe_unused]] uint8_t value = *byte;
+    }
+  }
+}
+
 } // namespace kungfu::yijinjing::os
@@ -1,9 +1,20 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <fmt/format.h>
-#include <regex>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define KF_TSC_CLOCK
+#endif
 
 #include <kungfu/common.h>
 #include <kungfu/yijinjing/time.h>
@@ -38,8 +49,148 @@ inline int64_t steady_clock_count() { return NOW_SINCE_EPOCH(steady_clock).count
 
 #endif
 
+#ifdef KF_TSC_CLOCK
+
+/**
+ * steady clock count extrapolated from cpu time stamp counter, saves the vDSO call of clock_gettime.
+ * Only used if TSC is invariant and trusted by kernel as clock source, so that it ticks at constant rate on all cores.
+ * Anchored to steady clock and re-synchronized every SYNC_INTERVAL, so it never drifts further than rate error of
+ * one interval, tick rate is adjusted at each sync to follow NTP slewing of steady clock.
+ */
+class tsc_clock {
+public:
+  static constexpr int SHIFT = 24;
+  static constexpr int64_t SYNC_INTERVAL = 100 * time_unit::NANOSECONDS_PER_MILLISECOND;
+  static constexpr int64_t CALIBRATE_INTERVAL = 10 * time_unit::NANOSECONDS_PER_MILLISECOND;
+
+  static bool is_usable() {
+    uint32_t eax, ebx, ecx, edx;
+    if (not __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) or not(edx & (1u << 8u))) {
+      return false;
+    }
+    std::ifstream clock_source("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+    std::string name;
+    return clock_source >> name and name == "tsc";
+  }
+
+  void calibrate() {
+    auto [tsc, steady] = read_anchor();
+    while (steady_clock_count() - steady < CALIBRATE_INTERVAL) {
+    }
+    sync(tsc, steady, sequence_.load());
+  }
+
+  int64_t steady_count() {
+    while (true) {
+      auto sequence = sequence_.load(std::memory_order_acquire);
+      auto anchor_tsc = anchor_tsc_.load(std::memory_order_relaxed);
+      auto anchor_steady = anchor_steady_.load(std::memory_order_relaxed);
+      auto mult = mult_.load(std::memory_order_relaxed);
+      auto sync_ticks = sync_ticks_.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence & 1u) {
+        return steady_clock_count(); // being synchronized by another thread
+      }
+      if (sequence != sequence_.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      auto ticks = static_cast<int64_t>(__rdtsc() - anchor_tsc);
+      if (ticks >= 0 and ticks < sync_ticks) {
+        return anchor_steady + ((ticks * mult) >> SHIFT);
+      }
+      return sync(anchor_tsc, anchor_steady, sequence);
+    }
+  }
+
+private:
+  static constexpr int ANCHOR_READ_TRIES = 4;
+
+  std::atomic<uint32_t> sequence_ = 0;
+  std::atomic<uint64_t> anchor_tsc_ = 0;
+  std::atomic<int64_t> anchor_steady_ = 0;
+  /** nanoseconds per tick, fixed point with SHIFT fraction bits */
+  std::atomic<int64_t> mult_ = 0;
+  std::atomic<int64_t> sync_ticks_ = 0;
+
+  /**
+   * read steady clock together with the tsc at the middle of the read, takes the tightest of a few tries in case
+   * the thread gets preempted in between
+   */
+  static std::pair<uint64_t, int64_t> read_anchor() {
+    uint64_t best_tsc = 0;
+    uint64_t best_window = UINT64_MAX;
+    int64_t best_steady = 0;
+    for (int i = 0; i < ANCHOR_READ_TRIES; i++) {
+      auto before = __rdtsc();
+      auto steady = steady_clock_count();
+      auto after = __rdtsc();
+      if (after - before < best_window) {
+        best_window = after - before;
+        best_tsc = before + best_window / 2;
+        best_steady = steady;
+      }
+    }
+    return {best_tsc, best_steady};
+  }
+
+  /**
+   * move anchor to now and re-estimate tick rate since last anchor, only one thread does it at a time,
+   * the others keep using steady clock meanwhile
+   */
+  int64_t sync(uint64_t last_tsc, int64_t last_steady, uint32_t sequence) {
+    if (sequence & 1u or not sequence_.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) {
+      return steady_clock_count();
+    }
+    auto [tsc, steady] = read_anchor();
+    auto ticks = static_cast<double>(tsc - last_tsc);
+    auto rate = ticks > 0 ? static_cast<double>(steady - last_steady) / ticks : 0;
+    auto last_mult = mult_.load(std::memory_order_relaxed);
+    auto mult = static_cast<int64_t>(rate * (1u << SHIFT));
+    // smooth out jitter of reading steady clock, unless previous estimate is far off, e.g. first calibration
+    if (last_mult > 0 and std::abs(mult - last_mult) < last_mult / 1000) {
+      mult = (last_mult * 7 + mult) / 8;
+    }
+    if (mult > 0) {
+      anchor_tsc_.store(tsc, std::memory_order_relaxed);
+      anchor_steady_.store(steady, std::memory_order_relaxed);
+      mult_.store(mult, std::memory_order_relaxed);
+      sync_ticks_.store((SYNC_INTERVAL << SHIFT) / mult, std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+    return steady;
+  }
+};
+
+static tsc_clock tsc_clock_instance = {};
+
+static std::atomic<bool> tsc_clock_enabled = false;
+
+bool time::set_tsc_clock(bool enabled) {
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (enabled and not tsc_clock_enabled and tsc_clock::is_usable()) {
+    tsc_clock_instance.calibrate();
+    tsc_clock_enabled = true;
+  } else if (not enabled) {
+    tsc_clock_enabled = false;
+  }
+  return tsc_clock_enabled;
+}
+
+inline int64_t now_steady_clock_count() {
+  return tsc_clock_enabled.load(std::memory_order_relaxed) ? tsc_clock_instance.steady_count() : steady_clock_count();
+}
+
+#else
+
+bool time::set_tsc_clock(bool enabled) { return false; }
+
+inline int64_t now_steady_clock_count() { return steady_clock_count(); }
+
+#endif
+
 int64_t time::now_in_nano() {
-  auto duration = steady_clock_count() - get_instance().base_.steady_clock_count;
+  auto duration = now_steady_clock_count() - get_instance().base_.steady_clock_count;
   return get_instance().base_.system_clock_count + duration;
 }
 
@@ -66,29 +217,125 @@ int64_t time::calendar_day_start(int64_t nanotime) {
 
 int64_t time::today_start() { return calendar_day_start(time::now_in_nano()); }
 
-int64_t time::strptime(const std::string &time_string, const std::string &format) {
-  int64_t nano = 0;
-  std::string normal_timestr = time_string;
-  std::string normal_format = format;
-
-  std::regex nano_format_regex("%N");
-  if (std::regex_search(format, nano_format_regex)) {
-    normal_format = std::regex_replace(format, nano_format_regex, "");
-
-    std::regex nano_regex("(\\d{9})");
+/**
+ * parse digits of up to max_width into value, at least one digit
+ */
+static bool parse_digits(const char *&cursor, const char *end, int max_width, int &value) {
+  auto begin = cursor;
+  value = 0;
+  while (cursor < end and cursor - begin < max_width and std::isdigit(static_cast<unsigned char>(*cursor))) {
+    value = value * 10 + (*cursor++ - '0');
+  }
+  return cursor > begin;
+}
 
-    auto nano_begin = std::sregex_iterator(normal_timestr.begin(), normal_timestr.end(), nano_regex);
-    auto nano_end = std::sregex_iterator();
-    for (std::sregex_iterator i = nano_begin; i != nano_end; ++i) {
-      std::smatch match = *i;
-      nano = stol(match.str());
-      normal_timestr = std::regex_replace(time_string, nano_regex, "");
+/**
+ * hand-written parser for the numeric formats used across the project: %Y %m %d %H %M %S %F %T %N and literals,
+ * %N takes exactly 9 digits
+ * @return false if format has other directives or string does not match, for strptime to fall back to std::get_time
+ */
+static bool parse_time(const std::string &time_string, const std::string &compound_format, std::tm &result,
+                       int64_t &nano) {
+  std::string format;
+  for (size_t i = 0; i < compound_format.size(); i++) {
+    auto directive = compound_format[i] == '%' and i + 1 < compound_format.size() ? compound_format[++i] : '\0';
+    if (directive == 'F') {
+      format.append("%Y-%m-%d");
+    } else if (directive == 'T') {
+      format.append("%H:%M:%S");
+    } else if (directive != '\0') {
+      format.push_back('%');
+      format.push_back(directive);
+    } else {
+      format.push_back(compound_format[i]);
     }
   }
+  const char *cursor = time_string.data();
+  const char *end = cursor + time_string.size();
+  for (size_t i = 0; i < format.size(); i++) {
+    if (format[i] != '%') {
+      if (cursor == end or *cursor++ != format[i]) {
+        return false;
+      }
+      continue;
+    }
+    if (++i == format.size()) {
+      return false;
+    }
+    bool parsed = true;
+    switch (format[i]) {
+    case 'Y':
+      parsed = parse_digits(cursor, end, 4, result.tm_year);
+      result.tm_year -= 1900;
+      break;
+    case 'm':
+      parsed = parse_digits(cursor, end, 2, result.tm_mon);
+      result.tm_mon -= 1;
+      break;
+    case 'd':
+      parsed = parse_digits(cursor, end, 2, result.tm_mday);
+      break;
+    case 'H':
+      parsed = parse_digits(cursor, end, 2, result.tm_hour);
+      break;
+    case 'M':
+      parsed = parse_digits(cursor, end, 2, result.tm_min);
+      break;
+    case 'S':
+      parsed = parse_digits(cursor, end, 2, result.tm_sec);
+      break;
+    case 'N': {
+      int high, low;
+      auto begin = cursor;
+      parsed = parse_digits(cursor, end, 4, high) and parse_digits(cursor, end, 5, low) and cursor - begin == 9 and
+               (cursor == end or not std::isdigit(static_cast<unsigned char>(*cursor)));
+      nano = int64_t(high) * 100000 + low;
+      break;
+    }
+    case '%':
+      parsed = cursor < end and *cursor++ == '%';
+      break;
+    default:
+      return false;
+    }
+    if (not parsed) {
+      return false;
+    }
+  }
+  return cursor == end;
+}
 
+int64_t time::strptime(const std::string &time_string, const std::string &format) {
+  int64_t nano = 0;
   std::tm result = {};
-  std::istringstream iss(normal_timestr);
-  iss >> std::get_time(&result, normal_format.c_str());
+  if (not parse_time(time_string, format, result, nano)) {
+    // drop %N from format, and take the last run of 9 digits from string as nanoseconds
+    std::string normal_timestr = time_string;
+    std::string normal_format = format;
+    nano = 0;
+    for (auto pos = normal_format.find("%N"); pos != std::string::npos; pos = normal_format.find("%N", pos)) {
+      normal_format.erase(pos, 2);
+    }
+    if (normal_format.size() != format.size()) {
+      normal_timestr.clear();
+      for (size_t i = 0; i < time_string.size();) {
+        size_t digits = 0;
+        while (i + digits < time_string.size() and std::isdigit(static_cast<unsigned char>(time_string[i + digits]))) {
+          digits++;
+        }
+        if (digits >= 9) {
+          nano = std::stol(time_string.substr(i, 9));
+          i += 9;
+        } else {
+          normal_timestr.append(time_string, i, std::max<size_t>(digits, 1));
+          i += std::max<size_t>(digits, 1);
+        }
+      }
+    }
+    result = {};
+    std::istringstream iss(normal_timestr);
+    iss >> std::get_time(&result, normal_format.c_str());
+  }
   std::time_t parsed_time = std::mktime(&result);
   auto tp_system = system_clock::from_time_t(parsed_time);
   return duration_cast<nanoseconds>(tp_system.time_since_epoch()).count() + nano;
@@ -104,34 +351,110 @@ int64_t time::strptime(const std::string &time_string, std::initializer_list<std
   return -1;
 }
 
-std::string time::strftime(int64_t nanotime, const std::string &format) {
-  if (nanotime == INT64_MAX) {
-    return "end of world";
+/**
+ * format rendered for one second, split into segments at %N, per thread and kept for a few formats,
+ * so that timestamps within the same second only need the sub-second part rendered
+ */
+struct strftime_cache {
+  static constexpr size_t SIZE = 4;
+  static constexpr size_t SEGMENT_SIZE = 256;
+
+  struct entry {
+    std::string format;
+    std::time_t second = 0;
+    bool valid = false;
+    std::vector<std::string> segments = {};
+  };
+
+  entry entries[SIZE] = {};
+  size_t next = 0;
+
+  const std::vector<std::string> &get(std::time_t second, const char *format) {
+    for (auto &entry : entries) {
+      if (entry.valid and entry.second == second and entry.format == format) {
+        return entry.segments;
+      }
+    }
+    auto &entry = find_slot(format);
+    std::tm tm = {};
+#ifdef _WINDOWS
+    localtime_s(&tm, &second);
+#else
+    localtime_r(&second, &tm);
+#endif
+    entry.second = second;
+    entry.valid = true;
+    entry.segments.clear();
+    char buffer[SEGMENT_SIZE];
+    std::string_view rest = entry.format;
+    while (true) {
+      auto pos = rest.find("%N");
+      auto segment_format = std::string(rest.substr(0, pos));
+      auto length = ::strftime(buffer, sizeof(buffer), segment_format.c_str(), &tm);
+      entry.segments.emplace_back(buffer, length);
+      if (pos == std::string_view::npos) {
+        break;
+      }
+      rest.remove_prefix(pos + 2);
+    }
+    return entry.segments;
   }
-  time_point<steady_clock> tp_steady((nanoseconds(nanotime)));
-  auto tp_epoch_steady = time_point<steady_clock>{};
-  auto tp_diff = tp_steady - tp_epoch_steady;
 
-  auto tp_epoch_system = time_point<system_clock>{};
-  std::time_t time_since_epoch =
-      system_clock::to_time_t(tp_epoch_system + duration_cast<system_clock::duration>(tp_diff));
+  entry &find_slot(const char *format) {
+    for (auto &entry : entries) {
+      if (entry.valid and entry.format == format) {
+        return entry;
+      }
+    }
+    auto &entry = entries[next++ % SIZE];
+    entry.format = format;
+    return entry;
+  }
+};
 
-  std::string normal_format = format;
-  std::regex nano_format_regex("%N");
-  if (std::regex_search(format, nano_format_regex)) {
-    int64_t nano = tp_diff.count() % time_unit::NANOSECONDS_PER_SECOND;
-    normal_format = std::regex_replace(format, nano_format_regex, fmt::format("{:09d}", nano));
+size_t time::strftime(char *buffer, size_t size, int64_t nanotime, const char *format) {
+  std::string_view text;
+  if (nanotime == INT64_MAX) {
+    text = "end of world";
+    auto length = std::min(size, text.size());
+    memcpy(buffer, text.data(), length);
+    return length;
   }
+  static thread_local strftime_cache cache = {};
+  auto &segments = cache.get(static_cast<std::time_t>(nanotime / time_unit::NANOSECONDS_PER_SECOND), format);
+  char nano[16];
+  auto nano_length = fmt::format_to_n(nano, sizeof(nano), "{:09d}", nanotime % time_unit::NANOSECONDS_PER_SECOND).size;
+  size_t length = 0;
+  for (size_t i = 0; i < segments.size(); i++) {
+    auto &segment = segments[i];
+    if (length + segment.size() + nano_length > size) {
+      return 0;
+    }
+    memcpy(buffer + length, segment.data(), segment.size());
+    length += segment.size();
+    if (i + 1 < segments.size()) {
+      memcpy(buffer + length, nano, nano_length);
+      length += nano_length;
+    }
+  }
+  if (nanotime <= 0) {
+    // mask out dummy time
+    for (size_t i = 0; i < length; i++) {
+      buffer[i] = std::isdigit(static_cast<unsigned char>(buffer[i])) ? (nanotime == 0 ? '0' : '#') : buffer[i];
+    }
+  }
+  return length;
+}
 
-  std::ostringstream oss;
-  oss << std::put_time(std::localtime(&time_since_epoch), normal_format.c_str());
-  if (nanotime > 0) {
-    return oss.str();
-  } else if (nanotime == 0) {
-    return std::regex_replace(oss.str(), std::regex("\\d"), "0");
-  } else {
-    return std::regex_replace(oss.str(), std::regex("\\d"), "#");
+std::string time::strftime(int64_t nanotime, const std::string &format) {
+  char buffer[strftime_cache::SEGMENT_SIZE * 2];
+  auto length = strftime(buffer, sizeof(buffer), nanotime, format.c_str());
+  if (length == 0 and not format.empty()) {
+    std::string text(format.size() * 8 + strftime_cache::SEGMENT_SIZE, '\0');
+    text.resize(strftime(text.data(), text.size(), nanotime, format.c_str()));
+    return text;
   }
+  return std::string(buffer, length);
 }
 
 std::string time::strfnow(const std::string &format) { return strftime(now_in_nano(), format); }
@@ -151,6 +474,10 @@ void time::reset(int64_t system_clock_count, int64_t steady_clock_count) {
 time::time() : base_() {
   base_.system_clock_count = system_clock_count();
   base_.steady_clock_count = steady_clock_count();
+  char *tsc_clock = std::getenv("KF_TSC_CLOCK");
+  if (tsc_clock != nullptr and std::atoi(tsc_clock) > 0 and not set_tsc_clock(true)) {
+    SPDLOG_WARN("TSC is not invariant or not trusted by kernel, fall back to steady clock");
+  }
 }
 
 const time &time::get_instance() {
@@ -20,7 +20,12 @@ from kungfu.yijinjing import time as kft
 from kungfu.yijinjing.log import create_logger
 from kungfu.yijinjing.locator import Locator
 from kungfu.yijinjing.sinks.archive import ArchiveSink
-from kungfu.yijinjing.utils import prune_layout_files, prue_layout_dirs_before_timestamp
+from kungfu.yijinjing.utils import (
+    glob_journal_pages,
+    glob_journal_sidecars,
+    prune_layout_files,
+    prue_layout_dirs_before_timestamp,
+)
 
 
 SESSION_DATETIME_FORMAT = "%Y-%m-%d %H:%M:%S"
@@ -112,12 +117,15 @@ def sessions(ctx, sortby, ascending, tablefmt):
 
 
 @journal.command()
+@click.option(
+    "-F", "--full", is_flag=True, help="rebuild from scratch instead of last checkpoint"
+)
 @journal_command_context
-def rebuild_index(ctx):
+def rebuild_index(ctx, full):
     io_device = yjj.io_device(ctx.console_location)
     session_builder = yjj.session_builder(io_device)
     click.echo("rebuild sqlite db")
-    session_builder.rebuild_index_db()
+    session_builder.rebuild_index_db(full)
     click.echo("done")
 
 
@@ -146,9 +154,16 @@ def show(ctx, session_id, io_type, csv):
     help="input or output during this session",
 )
 @click.option("-o", "--csv", type=str, default="", help="csv file")
+@click.option(
+    "-c",
+    "--columns",
+    type=str,
+    default="",
+    help="directory to export columnar binary files to, one per msg type",
+)
 @journal_command_context
-def trace(ctx, session_id, io_type, csv):
-    kfj.trace_journal(ctx, session_id, io_type, csv)
+def trace(ctx, session_id, io_type, csv, columns):
+    kfj.trace_journal(ctx, session_id, io_type, csv, columns)
 
 
 @journal.command()
@@ -156,12 +171,12 @@ def trace(ctx, session_id, io_type, csv):
 @click.option("-D", "--dry", is_flag=True, help="dry run")
 @journal_command_context
 def clean(ctx, archive, dry):
-    search_path = os.path.join(
-        ctx.runtime_dir, "*", "*", "*", "journal", "*", "*.journal"
-    )
-    journal_files = glob.glob(search_path)
+    search_path = os.path.join(ctx.runtime_dir, "*", "*", "*", "journal", "*")
+    journal_files = glob_journal_pages(search_path)
+    # sidecars would point to pages no longer there, they go along
+    sidecar_files = glob_journal_sidecars(search_path)
     if dry:
-        for journal_file in journal_files:
+        for journal_file in journal_files + sidecar_files:
             click.echo(f"rm {journal_file}")
         return
     if archive:
@@ -173,7 +188,7 @@ def clean(ctx, archive, dry):
         for journal_file in journal_files:
             archive_zip.write(journal_file)
         click.echo(f"archived to {archive_path}")
-    for journal_file in journal_files:
+    for journal_file in journal_files + sidecar_files:
         os.remove(journal_file)
     click.echo(f"cleaned {len(journal_files)} journal files")
 
@@ -48,7 +48,7 @@ JOURNAL_PAGE_REGEX = "{}{}{}{}{}{}{}{}{}{}{}".format(
     os_sep,  # mode
     r"(.*)",
     os_sep,  # mode
-    r"(\w+).(\d+).journal",  # hash + page_id
+    r"(\w+).(\d+).z?journal",  # hash + page_id
 )
 JOURNAL_PAGE_PATTERN = re.compile(JOURNAL_PAGE_REGEX)
 
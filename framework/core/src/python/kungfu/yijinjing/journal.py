@@ -5,6 +5,7 @@ import json
 import kungfu
 
 from kungfu.yijinjing import *
+from kungfu.yijinjing.utils import glob_journal_pages
 
 lf = kungfu.__binding__.longfist
 yjj = kungfu.__binding__.yijinjing
@@ -19,10 +20,9 @@ def collect_journal_locations(ctx):
         ctx.name,
         "journal",
         ctx.mode,
-        "*.journal",
     )
     locations = {}
-    for journal in glob.glob(search_path):
+    for journal in glob_journal_pages(search_path):
         match = JOURNAL_PAGE_PATTERN.match(journal[len(ctx.runtime_dir) + 1 :])
         if match:
             category = match.group(1)
@@ -152,10 +152,19 @@ def show_journal(ctx, session_id, io_type, csv):
     )
 
 
-def trace_journal(ctx, session_id, io_type, csv):
+def trace_journal(ctx, session_id, io_type, csv, columns=""):
     locations, session, io_device, show_in, show_out = read_session(
         ctx, session_id, io_type
     )
+    if columns:
+        io_device.export_columns(
+            session["begin_time"],
+            session["end_time"],
+            show_in,
+            show_out,
+            columns,
+        )
+        return
     io_device.trace(
         session["begin_time"],
         session["end_time"],
@@ -7,6 +7,7 @@ import os
 import shutil
 
 from kungfu.yijinjing import *
+from kungfu.yijinjing.utils import glob_journal_pages
 
 lf = kungfu.__binding__.longfist
 yjj = kungfu.__binding__.yijinjing
@@ -67,11 +68,9 @@ class Locator(yjj.locator):
 
     def list_page_id(self, location, dest_id):
         page_ids = []
-        for journal in glob.glob(
-            os.path.join(
-                self.layout_dir(location, lf.enums.layout.JOURNAL),
-                hex(dest_id)[2:] + ".*.journal",
-            )
+        for journal in glob_journal_pages(
+            self.layout_dir(location, lf.enums.layout.JOURNAL),
+            hex(dest_id)[2:] + ".*",
         ):
             match = JOURNAL_PAGE_PATTERN.match(journal[len(self._root) + 1 :])
             if match:
@@ -103,10 +102,9 @@ class Locator(yjj.locator):
             location.name,
             "journal",
             lf.enums.get_mode_name(location.mode),
-            "*.journal",
         )
         readers = {}
-        for journal in glob.glob(search_path):
+        for journal in glob_journal_pages(search_path):
             match = JOURNAL_PAGE_PATTERN.match(journal[len(self._root) + 1 :])
             if match:
                 dest = match.group(5)
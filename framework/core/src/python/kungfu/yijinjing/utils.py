@@ -5,6 +5,26 @@ import os
 from collections import deque
 
 
+def glob_journal_pages(search_dir, pattern="*"):
+    # pages compressed by archive are kept as .zjournal
+    extensions = ["journal", "zjournal"]
+    return [
+        page
+        for extension in extensions
+        for page in glob.glob(os.path.join(search_dir, f"{pattern}.{extension}"))
+    ]
+
+
+def glob_journal_sidecars(search_dir, pattern="*"):
+    # page index, frame indexes, checksums and preloaded pages not published yet
+    extensions = ["index", "sum", "journal.preload"]
+    return [
+        sidecar
+        for extension in extensions
+        for sidecar in glob.glob(os.path.join(search_dir, f"{pattern}.{extension}"))
+    ]
+
+
 def prune_layout_files(base_dir, layout, mode):
     search_path = os.path.join(base_dir, "*", "*", "*", layout, mode, "*")
     for file in filter(os.path.isfile, glob.glob(search_path)):